@@ -0,0 +1,51 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Allocator returning storage aligned to a cache line (and to the widest
+ * vector registers), so std::vector buffers can be used by SIMD loops and
+ * written out or mapped as flat arrays.
+ */
+template<typename T, std::size_t Alignment = 64>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template<typename U>
+    explicit AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept { return true; }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}// namespace strom
@@ -0,0 +1,202 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "split.hpp"
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fmt/format.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Average standard deviation of split frequencies between independent runs,
+ * updated one tree at a time. Split counts for all runs live in one flat
+ * table indexed through a hash of the split, so adding a tree costs O(number
+ * of splits in the tree). With a window fraction f < 1 only the last
+ * ceil(f * n) of the n trees read from each run are counted: each run keeps
+ * the split indices of the trees in its window so that trees sliding out of
+ * it can be subtracted again. Trivial splits (one leaf, or all but one leaf)
+ * are ignored, and a split only contributes if its frequency reaches the
+ * minimum frequency in at least one run.
+ */
+class ASDSFCalculator {
+public:
+    ASDSFCalculator();
+
+    void setNumRuns(unsigned nruns);
+
+    void setMinFrequency(double min_frequency);
+
+    void setWindowFraction(double window_fraction);
+
+    void addTree(unsigned run, const Split::treeid_t &splits);
+
+    [[nodiscard]] double calcASDSF() const;
+
+    [[nodiscard]] unsigned getNumRuns() const { return static_cast<unsigned>(_runs.size()); }
+
+    [[nodiscard]] unsigned long getNumTrees(unsigned run) const;
+
+    [[nodiscard]] unsigned long getWindowSize(unsigned run) const;
+
+    void clear();
+
+private:
+    struct Run {
+        unsigned long ntrees;
+        unsigned long window_size;
+        std::deque<unsigned> split_ids;     // splits of the trees in the window, oldest first
+        std::deque<unsigned> tree_nsplits;  // number of entries in split_ids for each of those trees
+    };
+
+    unsigned getSplitId(const Split &split);
+
+    std::unordered_map<Split, unsigned, SplitHash> _split_ids;
+    std::vector<unsigned long> _counts;// [split id * nruns + run]
+    std::vector<Run> _runs;
+    double _min_frequency;
+    double _window_fraction;
+
+public:
+    typedef std::shared_ptr<ASDSFCalculator> SharedPtr;
+};
+
+inline ASDSFCalculator::ASDSFCalculator() {
+    _min_frequency = 0.1;
+    _window_fraction = 1.0;
+    clear();
+}
+
+inline void ASDSFCalculator::clear() {
+    _split_ids.clear();
+    _counts.clear();
+    for (auto &run : _runs) {
+        run = Run();
+    }
+}
+
+inline void ASDSFCalculator::setNumRuns(unsigned nruns) {
+    _runs.assign(nruns, Run());
+    clear();
+}
+
+inline void ASDSFCalculator::setMinFrequency(double min_frequency) {
+    if (min_frequency < 0.0 || min_frequency > 1.0) {
+        throw XStrom(fmt::format(FMT_STRING("ASDSF minimum split frequency {:g} is not between 0 and 1"), min_frequency));
+    }
+    _min_frequency = min_frequency;
+}
+
+// Must be set before any trees are added
+inline void ASDSFCalculator::setWindowFraction(double window_fraction) {
+    if (window_fraction <= 0.0 || window_fraction > 1.0) {
+        throw XStrom(fmt::format(FMT_STRING("ASDSF window fraction {:g} is not in (0, 1]"), window_fraction));
+    }
+    _window_fraction = window_fraction;
+}
+
+inline unsigned long ASDSFCalculator::getNumTrees(unsigned run) const {
+    return _runs.at(run).ntrees;
+}
+
+inline unsigned long ASDSFCalculator::getWindowSize(unsigned run) const {
+    return _runs.at(run).window_size;
+}
+
+inline unsigned ASDSFCalculator::getSplitId(const Split &split) {
+    auto [iter, inserted] = _split_ids.emplace(split, static_cast<unsigned>(_split_ids.size()));
+    if (inserted) {
+        _counts.resize(_counts.size() + _runs.size(), 0);
+    }
+    return iter->second;
+}
+
+inline void ASDSFCalculator::addTree(unsigned run, const Split::treeid_t &splits) {
+    if (run >= _runs.size()) {
+        throw XStrom(fmt::format(FMT_STRING("Run {:d} is out of range ({:d} runs)"), run, _runs.size()));
+    }
+    auto nruns = static_cast<unsigned>(_runs.size());
+    Run &r = _runs[run];
+    bool windowed = (_window_fraction < 1.0);
+
+    unsigned nsplits = 0;
+    for (auto &split : splits) {
+        unsigned nbits = split.countBits();
+        if (nbits <= 1 || nbits + 1 >= split.getNumLeaves()) {
+            continue;
+        }
+        unsigned id = getSplitId(split);
+        ++_counts[static_cast<std::size_t>(id) * nruns + run];
+        if (windowed) {
+            r.split_ids.push_back(id);
+            ++nsplits;
+        }
+    }
+    ++r.ntrees;
+    ++r.window_size;
+
+    if (windowed) {
+        r.tree_nsplits.push_back(nsplits);
+        auto target = static_cast<unsigned long>(std::ceil(_window_fraction * static_cast<double>(r.ntrees)));
+        while (r.window_size > target) {
+            // oldest tree leaves the window
+            for (unsigned i = r.tree_nsplits.front(); i > 0; --i) {
+                --_counts[static_cast<std::size_t>(r.split_ids.front()) * nruns + run];
+                r.split_ids.pop_front();
+            }
+            r.tree_nsplits.pop_front();
+            --r.window_size;
+        }
+    }
+}
+
+/*
+ * Cost is linear in the number of distinct splits seen, independent of the
+ * number of trees, so it can be polled while trees are still arriving.
+ */
+inline double ASDSFCalculator::calcASDSF() const {
+    auto nruns = static_cast<unsigned>(_runs.size());
+    if (nruns < 2) {
+        throw XStrom("ASDSF needs at least two runs");
+    }
+    for (unsigned run = 0; run < nruns; ++run) {
+        if (_runs[run].window_size == 0) {
+            throw XStrom(fmt::format(FMT_STRING("No trees have been read for run {:d}"), run + 1));
+        }
+    }
+
+    std::vector<double> frequencies(nruns);
+    double sd_sum = 0.0;
+    unsigned nused = 0;
+    for (std::size_t offset = 0; offset < _counts.size(); offset += nruns) {
+        double max_frequency = 0.0;
+        double mean = 0.0;
+        for (unsigned run = 0; run < nruns; ++run) {
+            frequencies[run] = static_cast<double>(_counts[offset + run]) / static_cast<double>(_runs[run].window_size);
+            max_frequency = std::max(max_frequency, frequencies[run]);
+            mean += frequencies[run];
+        }
+        if (max_frequency == 0.0 || max_frequency < _min_frequency) {
+            continue;
+        }
+        mean /= nruns;
+        double ss = 0.0;
+        for (double f : frequencies) {
+            ss += (f - mean) * (f - mean);
+        }
+        sd_sum += std::sqrt(ss / (nruns - 1));
+        ++nused;
+    }
+    return (nused > 0 ? sd_sum / nused : 0.0);
+}
+
+}// namespace strom
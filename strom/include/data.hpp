@@ -0,0 +1,376 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "hash.hpp"
+#include "partition.hpp"
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fmt/format.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ncl/nxsmultiformat.h"
+
+namespace strom {
+
+/*
+ * An alignment compressed into unique site patterns. Each observed state is
+ * stored as a bitmask over the character states, so ambiguity codes set
+ * several bits and missing data or gaps set them all. Patterns are kept in
+ * order of first appearance in a taxon-major matrix whose rows start on
+ * cache-line boundaries; each pattern has an integer weight (the number of
+ * sites showing it), and every site records the pattern it was mapped to.
+ *
+ * With a Partition, sites are compressed separately within each subset, and
+ * the patterns of each subset occupy a contiguous range of columns, in
+ * subset order. Without one, all sites form a single subset.
+ */
+class Data {
+public:
+    typedef std::uint32_t state_t;
+    typedef AlignedVector<state_t> pattern_matrix_t;
+    typedef std::vector<unsigned> pattern_counts_t;
+    typedef std::vector<std::string> taxon_names_t;
+
+    Data();
+
+    void setPartition(Partition::SharedPtr partition);
+
+    void getDataFromFile(const std::string &filename, MultiFormatReader::DataFormatType format = MultiFormatReader::NEXUS_FORMAT);
+
+    [[nodiscard]] unsigned getNumTaxa() const { return static_cast<unsigned>(_taxon_names.size()); }
+
+    [[nodiscard]] unsigned getNumStates() const { return _nstates; }
+
+    [[nodiscard]] unsigned getNumSites() const { return static_cast<unsigned>(_site_patterns.size()); }
+
+    [[nodiscard]] unsigned getNumPatterns() const { return static_cast<unsigned>(_pattern_counts.size()); }
+
+    [[nodiscard]] unsigned getPatternStride() const { return _pattern_stride; }
+
+    [[nodiscard]] const state_t *getTaxonPatterns(unsigned taxon) const;
+
+    [[nodiscard]] const pattern_counts_t &getPatternCounts() const { return _pattern_counts; }
+
+    [[nodiscard]] const std::vector<unsigned> &getSitePatterns() const { return _site_patterns; }
+
+    [[nodiscard]] const taxon_names_t &getTaxonNames() const { return _taxon_names; }
+
+    [[nodiscard]] state_t getMissingState() const;
+
+    [[nodiscard]] unsigned getNumSubsets() const { return static_cast<unsigned>(_subset_end.size()); }
+
+    [[nodiscard]] const std::vector<std::string> &getSubsetNames() const { return _subset_names; }
+
+    [[nodiscard]] unsigned getSubsetBegin(unsigned subset) const { return (subset == 0 ? 0 : _subset_end.at(subset - 1)); }
+
+    [[nodiscard]] unsigned getSubsetEnd(unsigned subset) const { return _subset_end.at(subset); }
+
+    [[nodiscard]] unsigned getSubsetNumSites(unsigned subset) const;
+
+    [[nodiscard]] std::shared_ptr<Data> firstPatterns(unsigned npatterns) const;
+
+    void clear();
+
+private:
+    void storeCharactersBlock(const NxsCharactersBlock *block, unsigned ntaxa);
+
+    void compressPatterns(const std::vector<state_t> &site_matrix, unsigned nsites);
+
+    void compressSubset(const std::vector<state_t> &columns, const std::vector<unsigned> &sites, std::vector<const state_t *> &unique_columns);
+
+    static unsigned numStatesForDataType(const NxsCharactersBlock *block);
+
+    taxon_names_t _taxon_names;
+    unsigned _nstates;
+    unsigned _pattern_stride;
+    pattern_matrix_t _patterns;// [taxon * _pattern_stride + pattern]
+    pattern_counts_t _pattern_counts;
+    std::vector<unsigned> _site_patterns;
+    Partition::SharedPtr _partition;
+    std::vector<std::string> _subset_names;
+    std::vector<unsigned> _subset_end;// one past the last pattern of each subset
+
+    // Sites read so far, taxon-major, before compression
+    std::vector<std::vector<state_t>> _site_states;
+
+public:
+    typedef std::shared_ptr<Data> SharedPtr;
+};
+
+inline Data::Data() {
+    _partition = nullptr;
+    clear();
+}
+
+inline void Data::clear() {
+    _taxon_names.clear();
+    _nstates = 0;
+    _pattern_stride = 0;
+    _patterns.clear();
+    _pattern_counts.clear();
+    _site_patterns.clear();
+    _subset_names.clear();
+    _subset_end.clear();
+    _site_states.clear();
+}
+
+// Kept across calls to clear(), so that it applies to the next file read
+inline void Data::setPartition(Partition::SharedPtr partition) {
+    _partition = partition;
+}
+
+inline unsigned Data::getSubsetNumSites(unsigned subset) const {
+    unsigned nsites = 0;
+    for (unsigned p = getSubsetBegin(subset); p < getSubsetEnd(subset); ++p) {
+        nsites += _pattern_counts[p];
+    }
+    return nsites;
+}
+
+/*
+ * Data made of the sites showing the first npatterns patterns, with the same
+ * taxa, as a single subset.
+ */
+inline Data::SharedPtr Data::firstPatterns(unsigned npatterns) const {
+    npatterns = std::min(npatterns, getNumPatterns());
+    std::vector<unsigned> sites;
+    for (unsigned s = 0; s < getNumSites(); ++s) {
+        if (_site_patterns[s] < npatterns) {
+            sites.push_back(s);
+        }
+    }
+    unsigned ntaxa = getNumTaxa();
+    auto nsites = static_cast<unsigned>(sites.size());
+    std::vector<state_t> site_matrix(static_cast<std::size_t>(ntaxa) * nsites);
+    for (unsigned t = 0; t < ntaxa; ++t) {
+        const state_t *patterns = getTaxonPatterns(t);
+        for (unsigned i = 0; i < nsites; ++i) {
+            site_matrix[static_cast<std::size_t>(t) * nsites + i] = patterns[_site_patterns[sites[i]]];
+        }
+    }
+
+    auto data = std::make_shared<Data>();
+    data->_taxon_names = _taxon_names;
+    data->_nstates = _nstates;
+    data->compressPatterns(site_matrix, nsites);
+    return data;
+}
+
+inline Data::state_t Data::getMissingState() const {
+    return (_nstates >= 32 ? ~state_t(0) : (state_t(1) << _nstates) - 1);
+}
+
+inline const Data::state_t *Data::getTaxonPatterns(unsigned taxon) const {
+    if (taxon >= getNumTaxa()) {
+        throw XStrom(fmt::format(FMT_STRING("Taxon index {:d} out of range ({:d} taxa)"), taxon, getNumTaxa()));
+    }
+    return _patterns.data() + static_cast<std::size_t>(taxon) * _pattern_stride;
+}
+
+/*
+ * Read every characters block of the first taxa block and concatenate their
+ * sites before compressing them into patterns. All blocks must have the
+ * same number of states.
+ */
+inline void Data::getDataFromFile(const std::string &filename, MultiFormatReader::DataFormatType format) {
+    clear();
+
+    // See http://phylo.bio.ku.edu/ncldocs/v2.1/funcdocs/index.html for NCL documentation
+    MultiFormatReader nexusReader(-1, NxsReader::WARNINGS_TO_STDERR);
+    try {
+        nexusReader.ReadFilepath(filename.c_str(), format);
+    } catch (const NxsException &x) {
+        nexusReader.DeleteBlocksFromFactories();
+        throw XStrom(fmt::format(FMT_STRING("Error reading {:s} (line {:d}): {:s}"), filename, x.line, x.msg));
+    } catch (...) {
+        nexusReader.DeleteBlocksFromFactories();
+        throw;
+    }
+
+    try {
+        if (nexusReader.GetNumTaxaBlocks() == 0) {
+            throw XStrom(fmt::format(FMT_STRING("No taxa found in {:s}"), filename));
+        }
+        NxsTaxaBlock *taxaBlock = nexusReader.GetTaxaBlock(0);
+        unsigned ntaxa = taxaBlock->GetNTax();
+        for (unsigned t = 0; t < ntaxa; ++t) {
+            _taxon_names.push_back(taxaBlock->GetTaxonLabel(t));
+        }
+        _site_states.resize(ntaxa);
+
+        unsigned nCharBlocks = nexusReader.GetNumCharactersBlocks(taxaBlock);
+        if (nCharBlocks == 0) {
+            throw XStrom(fmt::format(FMT_STRING("No characters found in {:s}"), filename));
+        }
+        for (unsigned b = 0; b < nCharBlocks; ++b) {
+            storeCharactersBlock(nexusReader.GetCharactersBlock(taxaBlock, b), ntaxa);
+        }
+    } catch (...) {
+        nexusReader.DeleteBlocksFromFactories();
+        throw;
+    }
+    nexusReader.DeleteBlocksFromFactories();
+
+    auto nsites = static_cast<unsigned>(_site_states[0].size());
+    std::vector<state_t> site_matrix;
+    site_matrix.reserve(static_cast<std::size_t>(getNumTaxa()) * nsites);
+    for (auto &row : _site_states) {
+        site_matrix.insert(site_matrix.end(), row.begin(), row.end());
+    }
+    _site_states.clear();
+    compressPatterns(site_matrix, nsites);
+}
+
+inline unsigned Data::numStatesForDataType(const NxsCharactersBlock *block) {
+    switch (block->GetDataType()) {
+        case NxsCharactersBlock::dna:
+        case NxsCharactersBlock::rna:
+        case NxsCharactersBlock::nucleotide:
+            return 4;
+        case NxsCharactersBlock::protein:
+            return 20;
+        case NxsCharactersBlock::standard:
+            return block->GetDatatypeMapperForChar(0)->GetNumStates();
+        default:
+            throw XStrom("Only nucleotide, protein and standard discrete characters are supported");
+    }
+}
+
+/*
+ * Translate the NCL state codes of one characters block into state bitmasks
+ * and append them to the sites of each taxon. Codes of ambiguous states are
+ * expanded through the block's datatype mapper; gaps and missing data match
+ * every state.
+ */
+inline void Data::storeCharactersBlock(const NxsCharactersBlock *block, unsigned ntaxa) {
+    unsigned nstates = numStatesForDataType(block);
+    if (_nstates == 0) {
+        _nstates = nstates;
+    } else if (nstates != _nstates) {
+        throw XStrom(fmt::format(FMT_STRING("Characters blocks have different numbers of states ({:d} and {:d})"), _nstates, nstates));
+    }
+    if (_nstates > 8 * sizeof(state_t)) {
+        throw XStrom(fmt::format(FMT_STRING("At most {:d} character states are supported"), 8 * sizeof(state_t)));
+    }
+    state_t missing = getMissingState();
+
+    unsigned nchar = block->GetNChar();
+    const NxsDiscreteDatatypeMapper *mapper = block->GetDatatypeMapperForChar(0);
+    std::unordered_map<NxsDiscreteStateCell, state_t> ambiguous;
+    for (unsigned t = 0; t < ntaxa; ++t) {
+        std::vector<state_t> &states = _site_states[t];
+        const NxsDiscreteStateRow &row = block->GetDiscreteMatrixRow(t);
+        if (row.size() != nchar) {
+            throw XStrom(fmt::format(FMT_STRING("Taxon {:s} has {:d} sites but the block has {:d}"), _taxon_names[t], row.size(), nchar));
+        }
+        for (NxsDiscreteStateCell code : row) {
+            if (code >= 0 && static_cast<unsigned>(code) < _nstates) {
+                states.push_back(state_t(1) << code);
+            } else if (code == NXS_MISSING_CODE || code == NXS_GAP_STATE_CODE) {
+                states.push_back(missing);
+            } else {
+                auto found = ambiguous.find(code);
+                if (found == ambiguous.end()) {
+                    state_t bits = 0;
+                    for (NxsDiscreteStateCell s : mapper->GetStateSetForCode(code)) {
+                        if (s >= 0 && static_cast<unsigned>(s) < _nstates) {
+                            bits |= state_t(1) << s;
+                        }
+                    }
+                    found = ambiguous.emplace(code, bits ? bits : missing).first;
+                }
+                states.push_back(found->second);
+            }
+        }
+    }
+}
+
+/*
+ * Columns (the states of all taxa at a site) are gathered into a site-major
+ * scratch buffer so that each one is a contiguous key, then compressed one
+ * subset at a time.
+ */
+inline void Data::compressPatterns(const std::vector<state_t> &site_matrix, unsigned nsites) {
+    unsigned ntaxa = getNumTaxa();
+    std::vector<state_t> columns(static_cast<std::size_t>(ntaxa) * nsites);
+    for (unsigned t = 0; t < ntaxa; ++t) {
+        for (unsigned s = 0; s < nsites; ++s) {
+            columns[static_cast<std::size_t>(s) * ntaxa + t] = site_matrix[static_cast<std::size_t>(t) * nsites + s];
+        }
+    }
+
+    std::vector<std::vector<unsigned>> subset_sites;
+    if (_partition) {
+        _partition->finalize(nsites);
+        _subset_names = _partition->getSubsetNames();
+        subset_sites.resize(_subset_names.size());
+        const std::vector<unsigned> &site_subsets = _partition->getSiteSubsets();
+        for (unsigned s = 0; s < nsites; ++s) {
+            subset_sites[site_subsets[s]].push_back(s);
+        }
+    } else {
+        _subset_names = {"default"};
+        subset_sites.resize(1);
+        for (unsigned s = 0; s < nsites; ++s) {
+            subset_sites[0].push_back(s);
+        }
+    }
+
+    std::vector<const state_t *> unique_columns;
+    _site_patterns.resize(nsites);
+    for (auto &sites : subset_sites) {
+        compressSubset(columns, sites, unique_columns);
+        _subset_end.push_back(getNumPatterns());
+    }
+
+    // Pad rows to whole cache lines; padding patterns are missing data with zero weight
+    const unsigned per_line = 64 / sizeof(state_t);
+    unsigned npatterns = getNumPatterns();
+    _pattern_stride = (npatterns + per_line - 1) / per_line * per_line;
+    _patterns.assign(static_cast<std::size_t>(ntaxa) * _pattern_stride, getMissingState());
+    for (unsigned p = 0; p < npatterns; ++p) {
+        for (unsigned t = 0; t < ntaxa; ++t) {
+            _patterns[static_cast<std::size_t>(t) * _pattern_stride + p] = unique_columns[p][t];
+        }
+    }
+}
+
+// Hash the columns of the given sites to find identical ones, appending new patterns
+inline void Data::compressSubset(const std::vector<state_t> &columns, const std::vector<unsigned> &sites, std::vector<const state_t *> &unique_columns) {
+    unsigned ntaxa = getNumTaxa();
+    struct ColumnHash {
+        unsigned ntaxa;
+        std::size_t operator()(const state_t *column) const {
+            return static_cast<std::size_t>(hashBytes(reinterpret_cast<const char *>(column), ntaxa * sizeof(state_t)));
+        }
+    };
+    struct ColumnEqual {
+        unsigned ntaxa;
+        bool operator()(const state_t *a, const state_t *b) const {
+            return std::equal(a, a + ntaxa, b);
+        }
+    };
+    std::unordered_map<const state_t *, unsigned, ColumnHash, ColumnEqual> pattern_index(sites.size(), ColumnHash{ntaxa}, ColumnEqual{ntaxa});
+
+    for (unsigned s : sites) {
+        const state_t *column = columns.data() + static_cast<std::size_t>(s) * ntaxa;
+        auto [iter, inserted] = pattern_index.emplace(column, static_cast<unsigned>(unique_columns.size()));
+        if (inserted) {
+            unique_columns.push_back(column);
+            _pattern_counts.push_back(0);
+        }
+        ++_pattern_counts[iter->second];
+        _site_patterns[s] = iter->second;
+    }
+}
+
+}// namespace strom
@@ -0,0 +1,101 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <fmt/format.h>
+#include <memory>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Running mean and variance (Welford's method) of every edge length of one
+ * topology, and of its tree length. Edge lengths are supplied as a flat
+ * vector in the fixed order produced by TreeManip::collectEdgeLengths, so
+ * slot i refers to the same edge in every tree with this topology.
+ */
+class EdgeLengthSummary {
+public:
+    EdgeLengthSummary();
+
+    void add(const std::vector<double> &edge_lengths);
+
+    [[nodiscard]] unsigned long getCount() const { return _n; }
+
+    [[nodiscard]] unsigned getNumEdges() const { return static_cast<unsigned>(_mean.size()); }
+
+    [[nodiscard]] double getMean(unsigned edge) const;
+
+    [[nodiscard]] double getVariance(unsigned edge) const;
+
+    [[nodiscard]] double getTreeLengthMean() const { return _tree_length_mean; }
+
+    [[nodiscard]] double getTreeLengthVariance() const;
+
+    void clear();
+
+private:
+    unsigned long _n;
+    std::vector<double> _mean;
+    std::vector<double> _m2;
+    double _tree_length_mean;
+    double _tree_length_m2;
+
+public:
+    typedef std::shared_ptr<EdgeLengthSummary> SharedPtr;
+};
+
+inline EdgeLengthSummary::EdgeLengthSummary() {
+    clear();
+}
+
+inline void EdgeLengthSummary::clear() {
+    _n = 0;
+    _mean.clear();
+    _m2.clear();
+    _tree_length_mean = 0.0;
+    _tree_length_m2 = 0.0;
+}
+
+inline void EdgeLengthSummary::add(const std::vector<double> &edge_lengths) {
+    if (_n == 0) {
+        _mean.assign(edge_lengths.size(), 0.0);
+        _m2.assign(edge_lengths.size(), 0.0);
+    } else if (edge_lengths.size() != _mean.size()) {
+        throw XStrom(fmt::format(FMT_STRING("Expected {:d} edge lengths for this topology but got {:d}"), _mean.size(), edge_lengths.size()));
+    }
+
+    ++_n;
+    double inv_n = 1.0 / static_cast<double>(_n);
+    double tree_length = 0.0;
+    for (unsigned i = 0; i < edge_lengths.size(); ++i) {
+        double x = edge_lengths[i];
+        double delta = x - _mean[i];
+        _mean[i] += delta * inv_n;
+        _m2[i] += delta * (x - _mean[i]);
+        tree_length += x;
+    }
+
+    double delta = tree_length - _tree_length_mean;
+    _tree_length_mean += delta * inv_n;
+    _tree_length_m2 += delta * (tree_length - _tree_length_mean);
+}
+
+inline double EdgeLengthSummary::getMean(unsigned edge) const {
+    return _mean.at(edge);
+}
+
+// Sample variance; zero until two trees have been added
+inline double EdgeLengthSummary::getVariance(unsigned edge) const {
+    return (_n > 1 ? _m2.at(edge) / static_cast<double>(_n - 1) : 0.0);
+}
+
+inline double EdgeLengthSummary::getTreeLengthVariance() const {
+    return (_n > 1 ? _tree_length_m2 / static_cast<double>(_n - 1) : 0.0);
+}
+
+}// namespace strom
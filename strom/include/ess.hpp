@@ -0,0 +1,120 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "fft.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Effective sample size of a sampled trace, using the autocorrelation
+ * function computed by FFT in O(N log N) and Geyer's initial monotone
+ * sequence estimator of the integrated autocorrelation time. The FFT
+ * workspace is kept between calls, so each worker thread should use its own
+ * ESSCalculator.
+ */
+class ESSCalculator {
+public:
+    ESSCalculator();
+
+    [[nodiscard]] double calcESS(const std::vector<double> &trace);
+
+    const std::vector<double> &calcAutocorrelation(const std::vector<double> &trace);
+
+    void clear();
+
+private:
+    std::vector<std::complex<double>> _workspace;
+    std::vector<double> _autocorrelation;
+
+public:
+    typedef std::shared_ptr<ESSCalculator> SharedPtr;
+};
+
+inline ESSCalculator::ESSCalculator() {
+    clear();
+}
+
+inline void ESSCalculator::clear() {
+    _workspace.clear();
+    _autocorrelation.clear();
+}
+
+/*
+ * Normalised autocorrelation at lags 0..N-1. The centred trace is padded
+ * with zeros to at least twice its length so that the circular correlation
+ * computed by the FFT equals the linear one. A constant trace has no
+ * defined autocorrelation and gives an empty result.
+ */
+inline const std::vector<double> &ESSCalculator::calcAutocorrelation(const std::vector<double> &trace) {
+    std::size_t n = trace.size();
+    _autocorrelation.clear();
+    if (n < 2) {
+        return _autocorrelation;
+    }
+
+    double mean = 0.0;
+    for (double x : trace) {
+        mean += x;
+    }
+    mean /= static_cast<double>(n);
+
+    _workspace.assign(nextPowerOfTwo(2 * n), std::complex<double>(0.0, 0.0));
+    for (std::size_t i = 0; i < n; ++i) {
+        _workspace[i] = trace[i] - mean;
+    }
+    fft(_workspace);
+    for (auto &x : _workspace) {
+        x = std::norm(x);
+    }
+    fft(_workspace, true);
+
+    double variance = _workspace[0].real();
+    if (variance <= 0.0) {
+        return _autocorrelation;
+    }
+    _autocorrelation.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        _autocorrelation[i] = _workspace[i].real() / variance;
+    }
+    return _autocorrelation;
+}
+
+/*
+ * Sums of adjacent pairs of autocorrelations are added while they stay
+ * positive, each capped at the previous one so the sequence is monotone.
+ * As in Stan, the ESS of anticorrelated traces is capped at N log10(N).
+ * Returns zero for a constant trace.
+ */
+inline double ESSCalculator::calcESS(const std::vector<double> &trace) {
+    const std::vector<double> &rho = calcAutocorrelation(trace);
+    if (rho.empty()) {
+        return 0.0;
+    }
+
+    std::size_t n = rho.size();
+    double sum = 0.0;
+    double previous = rho[0] + (n > 1 ? rho[1] : 0.0);
+    for (std::size_t k = 0; 2 * k + 1 < n; ++k) {
+        double gamma = rho[2 * k] + rho[2 * k + 1];
+        if (gamma <= 0.0) {
+            break;
+        }
+        gamma = std::min(gamma, previous);
+        sum += gamma;
+        previous = gamma;
+    }
+
+    double tau = std::max(2.0 * sum - 1.0, 1.0 / std::log10(static_cast<double>(n) + 1.0));
+    return static_cast<double>(n) / tau;
+}
+
+}// namespace strom
@@ -0,0 +1,75 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace strom {
+
+inline std::size_t nextPowerOfTwo(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+/*
+ * In-place iterative radix-2 Cooley-Tukey transform. The length of data must
+ * be a power of two. The inverse transform is scaled by 1/n, so that a
+ * forward transform followed by an inverse one restores the input.
+ */
+inline void fft(std::vector<std::complex<double>> &data, bool inverse = false) {
+    std::size_t n = data.size();
+    if (n & (n - 1)) {
+        throw XStrom("fft needs a power-of-two length");
+    }
+
+    // bit-reversal permutation
+    for (std::size_t i = 1, j = 0; i < n; ++i) {
+        std::size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+
+    const double pi = std::acos(-1.0);
+    for (std::size_t len = 2; len <= n; len <<= 1) {
+        double angle = 2.0 * pi / static_cast<double>(len) * (inverse ? 1.0 : -1.0);
+        std::size_t half = len / 2;
+        // twiddle factors for this stage, computed once rather than by repeated multiplication
+        std::vector<std::complex<double>> twiddle(half);
+        for (std::size_t k = 0; k < half; ++k) {
+            twiddle[k] = std::polar(1.0, angle * static_cast<double>(k));
+        }
+        for (std::size_t start = 0; start < n; start += len) {
+            for (std::size_t k = 0; k < half; ++k) {
+                std::complex<double> u = data[start + k];
+                std::complex<double> v = data[start + k + half] * twiddle[k];
+                data[start + k] = u + v;
+                data[start + k + half] = u - v;
+            }
+        }
+    }
+
+    if (inverse) {
+        double scale = 1.0 / static_cast<double>(n);
+        for (auto &x : data) {
+            x *= scale;
+        }
+    }
+}
+
+}// namespace strom
@@ -0,0 +1,156 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fmt/format.h>
+#include <limits>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Regularised lower incomplete gamma function P(shape, x), the CDF of a
+ * Gamma(shape, 1) variable at x. Uses the power series below shape + 1 and
+ * Lentz's continued fraction for the upper tail above it, both of which
+ * converge quickly in their regions.
+ */
+inline double incompleteGammaRatio(double x, double shape) {
+    if (!(shape > 0.0) || x < 0.0) {
+        throw XStrom(fmt::format(FMT_STRING("Incomplete gamma function needs shape > 0 and x >= 0, not shape {:g} and x {:g}"), shape, x));
+    }
+    if (x == 0.0) {
+        return 0.0;
+    }
+    const double epsilon = 1.0e-15;
+    const unsigned max_iterations = 10000;
+    double log_prefactor = shape * std::log(x) - x - std::lgamma(shape);
+    if (x < shape + 1.0) {
+        double term = 1.0 / shape;
+        double sum = term;
+        for (unsigned n = 1; n < max_iterations; ++n) {
+            term *= x / (shape + n);
+            sum += term;
+            if (term < sum * epsilon) {
+                break;
+            }
+        }
+        return std::min(1.0, sum * std::exp(log_prefactor));
+    }
+
+    const double tiny = 1.0e-300;
+    double b = x + 1.0 - shape;
+    double c = 1.0 / tiny;
+    double d = 1.0 / b;
+    double fraction = d;
+    for (unsigned n = 1; n < max_iterations; ++n) {
+        double a = -static_cast<double>(n) * (n - shape);
+        b += 2.0;
+        d = a * d + b;
+        d = (std::fabs(d) < tiny ? tiny : d);
+        c = b + a / c;
+        c = (std::fabs(c) < tiny ? tiny : c);
+        d = 1.0 / d;
+        double delta = c * d;
+        fraction *= delta;
+        if (std::fabs(delta - 1.0) < epsilon) {
+            break;
+        }
+    }
+    return std::max(0.0, 1.0 - fraction * std::exp(log_prefactor));
+}
+
+/*
+ * Quantile of Gamma(shape, 1) at probability p, by Newton's method on
+ * incompleteGammaRatio. Steps that leave the bracket known to contain the
+ * root are replaced by bisection, so it converges even for small shapes,
+ * where the density is steep near zero.
+ */
+inline double gammaQuantile(double p, double shape) {
+    if (!(p > 0.0 && p < 1.0) || !(shape > 0.0)) {
+        throw XStrom(fmt::format(FMT_STRING("Gamma quantile needs 0 < p < 1 and shape > 0, not p {:g} and shape {:g}"), p, shape));
+    }
+    double lower = 0.0;
+    double upper = std::max(1.0, shape);
+    while (incompleteGammaRatio(upper, shape) < p) {
+        lower = upper;
+        upper *= 2.0;
+    }
+
+    // Start from the mean, or the middle of the bracket if the mean is outside it
+    double x = (shape > lower && shape < upper ? shape : 0.5 * (lower + upper));
+
+    double log_normaliser = std::lgamma(shape);
+    for (unsigned iteration = 0; iteration < 200; ++iteration) {
+        double f = incompleteGammaRatio(x, shape) - p;
+        if (f < 0.0) {
+            lower = x;
+        } else {
+            upper = x;
+        }
+        double density = std::exp((shape - 1.0) * std::log(x) - x - log_normaliser);
+        double next = (density > 0.0 ? x - f / density : 0.5 * (lower + upper));
+        if (!(next > lower && next < upper)) {
+            next = 0.5 * (lower + upper);
+        }
+        if (std::fabs(next - x) <= 1.0e-14 * std::max(x, std::numeric_limits<double>::min()) || upper - lower <= 1.0e-15 * upper) {
+            return next;
+        }
+        x = next;
+    }
+    return x;
+}
+
+// Quantile of the chi-square distribution with df degrees of freedom
+inline double chiSquareQuantile(double p, double df) {
+    return 2.0 * gammaQuantile(p, 0.5 * df);
+}
+
+/*
+ * Rates of ncategories equiprobable categories of a gamma distribution with
+ * mean 1 and the given shape (Yang 1994). Each rate is either the mean of
+ * its category, computed from the incomplete gamma function with shape + 1,
+ * or its median, rescaled so that the rates average 1.
+ */
+inline std::vector<double> discreteGammaRates(double shape, unsigned ncategories, bool median) {
+    if (!(shape > 0.0) || ncategories == 0) {
+        throw XStrom(fmt::format(FMT_STRING("Discrete gamma needs shape > 0 and at least one category, not shape {:g} and {:d} categories"), shape,
+                                 ncategories));
+    }
+    std::vector<double> rates(ncategories, 1.0);
+    if (ncategories == 1) {
+        return rates;
+    }
+    double n = ncategories;
+    if (median) {
+        double sum = 0.0;
+        for (unsigned k = 0; k < ncategories; ++k) {
+            rates[k] = chiSquareQuantile((2.0 * k + 1.0) / (2.0 * n), 2.0 * shape) / (2.0 * shape);
+            sum += rates[k];
+        }
+        for (double &rate : rates) {
+            rate *= n / sum;
+        }
+        return rates;
+    }
+
+    // Mean rate of a category is n times the mass of Gamma(shape + 1) between its boundaries
+    double previous = 0.0;
+    for (unsigned k = 0; k < ncategories; ++k) {
+        double cumulative = 1.0;
+        if (k + 1 < ncategories) {
+            double boundary = gammaQuantile((k + 1.0) / n, shape);
+            cumulative = incompleteGammaRatio(boundary, shape + 1.0);
+        }
+        rates[k] = n * (cumulative - previous);
+        previous = cumulative;
+    }
+    return rates;
+}
+
+}// namespace strom
@@ -0,0 +1,37 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace strom {
+
+/*
+ * 64-bit FNV-1a hash of a byte string. The result depends only on the bytes,
+ * so it is stable across runs, platforms and compilers (unlike std::hash).
+ */
+inline std::uint64_t hashBytes(const char *data, std::size_t length) {
+    std::uint64_t h = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < length; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline std::uint64_t hashBytes(const std::string &s) {
+    return hashBytes(s.data(), s.size());
+}
+
+// Hasher for unordered containers keyed by strings
+struct StringHash {
+    std::size_t operator()(const std::string &s) const {
+        return static_cast<std::size_t>(hashBytes(s));
+    }
+};
+
+}// namespace strom
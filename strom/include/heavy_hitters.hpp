@@ -0,0 +1,167 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Bounded-memory tracking of the most frequent topologies (Space-Saving
+ * algorithm). At most capacity counters are kept, in a min-heap ordered by
+ * count. A topology that is not being tracked replaces the least frequent
+ * counter and inherits its count, which is recorded as the new entry's error.
+ * Each count overestimates the true frequency by at most its error, and every
+ * topology seen more than total/capacity times is guaranteed to be tracked.
+ */
+class HeavyHitters {
+public:
+    struct Entry {
+        std::uint64_t fingerprint;
+        unsigned long count;
+        unsigned long error;
+        std::string newick;// description of the tree that created the entry
+    };
+
+    HeavyHitters();
+
+    explicit HeavyHitters(unsigned capacity);
+
+    void setCapacity(unsigned capacity);
+
+    void clear();
+
+    void add(std::uint64_t fingerprint, const std::string &newick);
+
+    [[nodiscard]] unsigned getCapacity() const { return _capacity; }
+
+    [[nodiscard]] unsigned long getTotal() const { return _total; }
+
+    [[nodiscard]] unsigned long getMaxError() const;
+
+    [[nodiscard]] std::vector<Entry> getSortedEntries() const;
+
+private:
+    void swapEntries(unsigned i, unsigned j);
+
+    void siftUp(unsigned i);
+
+    void siftDown(unsigned i);
+
+    std::vector<Entry> _heap;
+    std::unordered_map<std::uint64_t, unsigned> _position;
+    unsigned _capacity;
+    unsigned long _total;
+
+public:
+    typedef std::shared_ptr<HeavyHitters> SharedPtr;
+};
+
+inline HeavyHitters::HeavyHitters() {
+    _capacity = 0;
+    clear();
+}
+
+inline HeavyHitters::HeavyHitters(unsigned capacity) {
+    _capacity = capacity;
+    clear();
+}
+
+inline void HeavyHitters::setCapacity(unsigned capacity) {
+    _capacity = capacity;
+    clear();
+}
+
+inline void HeavyHitters::clear() {
+    _heap.clear();
+    _heap.reserve(_capacity);
+    _position.clear();
+    _position.reserve(_capacity);
+    _total = 0;
+}
+
+inline void HeavyHitters::add(std::uint64_t fingerprint, const std::string &newick) {
+    assert(_capacity > 0);
+    ++_total;
+
+    auto found = _position.find(fingerprint);
+    if (found != _position.end()) {
+        ++_heap[found->second].count;
+        siftDown(found->second);
+    } else if (_heap.size() < _capacity) {
+        _heap.push_back({fingerprint, 1, 0, newick});
+        auto i = static_cast<unsigned>(_heap.size()) - 1;
+        _position[fingerprint] = i;
+        siftUp(i);
+    } else {
+        // Evict the least frequent topology; the newcomer inherits its count
+        Entry &smallest = _heap.front();
+        _position.erase(smallest.fingerprint);
+        smallest.error = smallest.count;
+        smallest.count += 1;
+        smallest.fingerprint = fingerprint;
+        smallest.newick = newick;
+        _position[fingerprint] = 0;
+        siftDown(0);
+    }
+}
+
+inline unsigned long HeavyHitters::getMaxError() const {
+    // No untracked topology can have been seen more often than the smallest counter
+    return (_heap.size() < _capacity ? 0 : _heap.front().count);
+}
+
+inline std::vector<HeavyHitters::Entry> HeavyHitters::getSortedEntries() const {
+    std::vector<Entry> entries = _heap;
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.count > b.count || (a.count == b.count && a.error < b.error);
+    });
+    return entries;
+}
+
+inline void HeavyHitters::swapEntries(unsigned i, unsigned j) {
+    std::swap(_heap[i], _heap[j]);
+    _position[_heap[i].fingerprint] = i;
+    _position[_heap[j].fingerprint] = j;
+}
+
+inline void HeavyHitters::siftUp(unsigned i) {
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (_heap[parent].count <= _heap[i].count) {
+            break;
+        }
+        swapEntries(i, parent);
+        i = parent;
+    }
+}
+
+inline void HeavyHitters::siftDown(unsigned i) {
+    auto n = static_cast<unsigned>(_heap.size());
+    while (true) {
+        unsigned smallest = i;
+        unsigned left = 2 * i + 1;
+        unsigned right = left + 1;
+        if (left < n && _heap[left].count < _heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < n && _heap[right].count < _heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swapEntries(i, smallest);
+        i = smallest;
+    }
+}
+
+}// namespace strom
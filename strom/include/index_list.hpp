@@ -0,0 +1,123 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Run-length encoded list of tree indices. Indices are appended in sampling
+ * order, and a topology that is visited repeatedly tends to collect long runs
+ * of consecutive indices, so each run is stored as (first index, length).
+ * Memory scales with the number of runs rather than the number of indices.
+ * Iteration decodes the runs on the fly.
+ */
+class IndexList {
+public:
+    typedef std::pair<unsigned, unsigned> run_t;
+
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef unsigned value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const unsigned *pointer;
+        typedef unsigned reference;
+
+        const_iterator(const run_t *run, unsigned offset) : _run(run), _offset(offset) {}
+
+        unsigned operator*() const { return _run->first + _offset; }
+
+        const_iterator &operator++() {
+            if (++_offset == _run->second) {
+                ++_run;
+                _offset = 0;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator==(const const_iterator &other) const { return _run == other._run && _offset == other._offset; }
+
+        bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+    private:
+        const run_t *_run;
+        unsigned _offset;
+    };
+
+    IndexList();
+
+    explicit IndexList(unsigned index);
+
+    void push_back(unsigned index);
+
+    void clear();
+
+    [[nodiscard]] unsigned size() const { return _size; }
+
+    [[nodiscard]] bool empty() const { return _size == 0; }
+
+    [[nodiscard]] unsigned front() const;
+
+    [[nodiscard]] unsigned back() const;
+
+    [[nodiscard]] unsigned numRuns() const { return static_cast<unsigned>(_runs.size()); }
+
+    [[nodiscard]] const std::vector<run_t> &getRuns() const { return _runs; }
+
+    [[nodiscard]] const_iterator begin() const { return {_runs.data(), 0}; }
+
+    [[nodiscard]] const_iterator end() const { return {_runs.data() + _runs.size(), 0}; }
+
+private:
+    std::vector<run_t> _runs;
+    unsigned _size;
+};
+
+inline IndexList::IndexList() {
+    clear();
+}
+
+inline IndexList::IndexList(unsigned index) {
+    clear();
+    push_back(index);
+}
+
+inline void IndexList::clear() {
+    _runs.clear();
+    _size = 0;
+}
+
+inline void IndexList::push_back(unsigned index) {
+    if (!_runs.empty() && _runs.back().first + _runs.back().second == index) {
+        ++_runs.back().second;
+    } else {
+        _runs.emplace_back(index, 1);
+    }
+    ++_size;
+}
+
+inline unsigned IndexList::front() const {
+    assert(!_runs.empty());
+    return _runs.front().first;
+}
+
+inline unsigned IndexList::back() const {
+    assert(!_runs.empty());
+    return _runs.back().first + _runs.back().second - 1;
+}
+
+}// namespace strom
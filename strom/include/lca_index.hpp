@@ -0,0 +1,252 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "tree.hpp"
+#include "xstrom.hpp"
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+#include <memory>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Constant-time most recent common ancestor and patristic distance queries.
+ *
+ * The index holds an Euler tour of the tree (built from _preorder), a sparse
+ * table over the depths of the tour entries for range-minimum queries, and the
+ * path length from the root to every node. After TreeManip edits the topology,
+ * refresh() rebuilds the tour and recomputes only those sparse table entries
+ * whose intervals overlap the part of the tour that changed.
+ */
+class LCAIndex {
+public:
+    LCAIndex();
+
+    explicit LCAIndex(Tree::SharedPtr t);
+
+    void setTree(Tree::SharedPtr t);
+
+    void refresh();
+
+    [[nodiscard]] int mrca(int first, int second) const;
+
+    [[nodiscard]] double patristicDistance(int first, int second) const;
+
+    [[nodiscard]] double rootDistance(int node_number) const;
+
+    void clear();
+
+private:
+    void buildEulerTour(Node::PtrVector &tour, std::vector<unsigned> &depth) const;
+
+    void updateSparseTable(unsigned lo, unsigned hi);
+
+    void refreshDistances();
+
+    [[nodiscard]] unsigned shallower(unsigned i, unsigned j) const;
+
+    void checkNodeNumber(int node_number) const;
+
+    Tree::SharedPtr _tree;
+    unsigned _topology_version;
+
+    Node::PtrVector _tour;
+    std::vector<unsigned> _depth;
+    std::vector<unsigned> _first_visit;// indexed by node number
+    std::vector<double> _distance;     // indexed by node number
+    std::vector<unsigned> _log2;
+    std::vector<unsigned> _sparse;// row k holds the shallowest tour position in [i, i + 2^k)
+    unsigned _nlevels;
+
+public:
+    typedef std::shared_ptr<LCAIndex> SharedPtr;
+};
+
+inline LCAIndex::LCAIndex() {
+    clear();
+}
+
+inline LCAIndex::LCAIndex(Tree::SharedPtr t) {
+    clear();
+    setTree(t);
+}
+
+inline void LCAIndex::clear() {
+    _tree.reset();
+    _topology_version = 0;
+    _tour.clear();
+    _depth.clear();
+    _first_visit.clear();
+    _distance.clear();
+    _log2.clear();
+    _sparse.clear();
+    _nlevels = 0;
+}
+
+inline void LCAIndex::setTree(Tree::SharedPtr t) {
+    assert(t);
+    clear();
+    _tree = t;
+    _topology_version = _tree->_topology_version;
+
+    buildEulerTour(_tour, _depth);
+    auto m = static_cast<unsigned>(_tour.size());
+
+    _log2.assign(m + 1, 0);
+    for (unsigned i = 2; i <= m; ++i) {
+        _log2[i] = _log2[i / 2] + 1;
+    }
+    _nlevels = _log2[m] + 1;
+    _sparse.resize(_nlevels * m);
+    updateSparseTable(0, m - 1);
+
+    refreshDistances();
+}
+
+/*
+ * Bring the index up to date with the tree. Edge lengths are always reread;
+ * the sparse table is only patched if the topology has changed since the
+ * index was built.
+ */
+inline void LCAIndex::refresh() {
+    assert(_tree);
+    if (_topology_version != _tree->_topology_version) {
+        Node::PtrVector tour;
+        std::vector<unsigned> depth;
+        buildEulerTour(tour, depth);
+        if (tour.size() != _tour.size()) {
+            setTree(_tree);
+            return;
+        }
+
+        auto m = static_cast<unsigned>(tour.size());
+        unsigned lo = 0;
+        while (lo < m && tour[lo] == _tour[lo] && depth[lo] == _depth[lo]) {
+            ++lo;
+        }
+        if (lo < m) {
+            unsigned hi = m - 1;
+            while (tour[hi] == _tour[hi] && depth[hi] == _depth[hi]) {
+                --hi;
+            }
+            _tour.swap(tour);
+            _depth.swap(depth);
+            updateSparseTable(lo, hi);
+        }
+        _topology_version = _tree->_topology_version;
+    }
+    refreshDistances();
+}
+
+/*
+ * Walk _preorder keeping the chain of ancestors of the current node. Each time
+ * the walk climbs back out of a subtree the parent is visited again, giving a
+ * tour of length 2 * (number of nodes) - 1 that starts and ends at the root.
+ */
+inline void LCAIndex::buildEulerTour(Node::PtrVector &tour, std::vector<unsigned> &depth) const {
+    Node *root = _tree->_root;
+    if (!root) {
+        throw XStrom("Cannot build LCA index for an empty tree");
+    }
+
+    tour.clear();
+    depth.clear();
+    tour.reserve(2 * _tree->_preorder.size() + 1);
+    depth.reserve(2 * _tree->_preorder.size() + 1);
+
+    Node::PtrVector ancestors;
+    ancestors.push_back(root);
+    tour.push_back(root);
+    depth.push_back(0);
+    for (auto nd : _tree->_preorder) {
+        while (ancestors.back() != nd->getParent()) {
+            ancestors.pop_back();
+            assert(!ancestors.empty());
+            tour.push_back(ancestors.back());
+            depth.push_back(static_cast<unsigned>(ancestors.size()) - 1);
+        }
+        tour.push_back(nd);
+        depth.push_back(static_cast<unsigned>(ancestors.size()));
+        ancestors.push_back(nd);
+    }
+    while (ancestors.size() > 1) {
+        ancestors.pop_back();
+        tour.push_back(ancestors.back());
+        depth.push_back(static_cast<unsigned>(ancestors.size()) - 1);
+    }
+}
+
+inline unsigned LCAIndex::shallower(unsigned i, unsigned j) const {
+    return (_depth[j] < _depth[i] ? j : i);
+}
+
+/*
+ * Recompute every sparse table entry whose interval overlaps the tour
+ * positions [lo, hi]. Entries covering only unchanged positions are kept.
+ */
+inline void LCAIndex::updateSparseTable(unsigned lo, unsigned hi) {
+    auto m = static_cast<unsigned>(_tour.size());
+    for (unsigned i = lo; i <= hi; ++i) {
+        _sparse[i] = i;
+    }
+    for (unsigned k = 1; k < _nlevels; ++k) {
+        unsigned width = 1u << k;
+        unsigned half = width / 2;
+        unsigned first = (lo + 1 > width ? lo + 1 - width : 0);
+        unsigned last = std::min(hi, m - width);
+        unsigned *row = &_sparse[k * m];
+        const unsigned *prev = &_sparse[(k - 1) * m];
+        for (unsigned i = first; i <= last; ++i) {
+            row[i] = shallower(prev[i], prev[i + half]);
+        }
+    }
+
+    _first_visit.assign(_tree->_node_index.size(), 0);
+    for (unsigned i = m; i-- > 0;) {
+        _first_visit[_tour[i]->getNumber()] = i;
+    }
+}
+
+inline void LCAIndex::refreshDistances() {
+    _distance.assign(_tree->_node_index.size(), 0.0);
+    for (auto nd : _tree->_preorder) {
+        _distance[nd->getNumber()] = _distance[nd->getParent()->getNumber()] + nd->getEdgeLength();
+    }
+}
+
+inline void LCAIndex::checkNodeNumber(int node_number) const {
+    if (node_number < 0 || node_number >= static_cast<int>(_first_visit.size()) || !_tree->_node_index[node_number]) {
+        throw XStrom(fmt::format(FMT_STRING("No node found with node number {:d}"), node_number));
+    }
+}
+
+inline int LCAIndex::mrca(int first, int second) const {
+    checkNodeNumber(first);
+    checkNodeNumber(second);
+    unsigned i = _first_visit[first];
+    unsigned j = _first_visit[second];
+    if (i > j) {
+        std::swap(i, j);
+    }
+    auto m = static_cast<unsigned>(_tour.size());
+    unsigned k = _log2[j - i + 1];
+    unsigned pos = shallower(_sparse[k * m + i], _sparse[k * m + j + 1 - (1u << k)]);
+    return _tour[pos]->getNumber();
+}
+
+inline double LCAIndex::patristicDistance(int first, int second) const {
+    int anc = mrca(first, second);
+    return _distance[first] + _distance[second] - 2.0 * _distance[anc];
+}
+
+inline double LCAIndex::rootDistance(int node_number) const {
+    checkNodeNumber(node_number);
+    return _distance[node_number];
+}
+
+}// namespace strom
@@ -0,0 +1,1103 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "data.hpp"
+#include "model.hpp"
+#include "parallel.hpp"
+#include "pruning_engine.hpp"
+#include "tree.hpp"
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fmt/format.h>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <range/v3/view/reverse.hpp>
+#include <string>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+
+namespace strom {
+
+/*
+ * Log-likelihood of a tree computed with BEAGLE. Buffers are indexed by
+ * node number: leaf n holds the tip data of the data row whose taxon name
+ * is that of leaf n, and every other node holds its partials and the
+ * transition matrix of the edge above it.
+ * Partials are computed in postorder, then combined across the edge to the
+ * root (the root leaf of an unrooted tree) or at the root's only child (a
+ * rooted tree). The "native" implementation runs the same calls through a
+ * PruningEngine instead of BEAGLE.
+ *
+ * Each subset of a partitioned Data has its own instance and Model, and the
+ * log-likelihood is the sum over subsets. All instances share the buffer
+ * layout and the operations of an evaluation, and run concurrently.
+ *
+ * Only the nodes flagged dirty by Node::setEdgeLength or by TreeManip are
+ * recomputed, and each node has two partials, scaler and transition matrix
+ * buffers. A recomputed node writes to its other buffer, so the values from
+ * before a proposal survive until acceptProposal, and revertProposal
+ * restores them by switching back rather than recomputing. The dirty flags
+ * belong to the tree, not to the Likelihood, so they are only trusted when
+ * this Likelihood evaluated the same tree last and no other Likelihood has
+ * evaluated it since; trees and Likelihoods carry serial numbers for this
+ * check, so a new tree at a freed tree's address is not mistaken for it.
+ * Otherwise the tree is treated as a different tree: a node keeps its
+ * partials if its buffer was computed from children with the same numbers,
+ * edge lengths and (recursively) partials, so consecutive trees of a sample
+ * share whatever subtrees they have in common.
+ *
+ * Transition matrix buffers remember the edge length they were computed
+ * for, so an edge set back to a length that either of its buffers holds is
+ * not recomputed. Changes to a model's parameters are picked up at the next
+ * evaluation, which then recomputes everything.
+ */
+class Likelihood {
+public:
+    Likelihood();
+
+    ~Likelihood();
+
+    Likelihood(const Likelihood &) = delete;
+
+    Likelihood &operator=(const Likelihood &) = delete;
+
+    void setData(Data::SharedPtr data);
+
+    void setTaxonNames(const std::vector<std::string> &names);
+
+    void setModel(Model::SharedPtr model);
+
+    void setSubsetModel(unsigned subset, Model::SharedPtr model);
+
+    void setImplementation(const std::string &implementation);
+
+    void setThreadCount(unsigned nthreads);
+
+    void setSinglePrecision(bool single_precision);
+
+    void initBeagleLib(const Tree &tree);
+
+    void finalizeBeagleLib();
+
+    [[nodiscard]] double calcLogLikelihood(const Tree &tree);
+
+    void getPatternLogLikelihoods(std::vector<double> &log_likelihoods);
+
+    void acceptProposal();
+
+    void revertProposal(const Tree &tree);
+
+    void invalidateBuffers();
+
+    [[nodiscard]] static std::string beagleLibVersion();
+
+    [[nodiscard]] std::string availableResources() const;
+
+    [[nodiscard]] std::string usedResources() const;
+
+    [[nodiscard]] unsigned getNumSubsets() const { return static_cast<unsigned>(_instances.size()); }
+
+    [[nodiscard]] unsigned long getNumEvaluations() const { return _nevaluations; }
+
+    [[nodiscard]] unsigned long getNumPartialsUpdates() const { return _npartials_updates; }
+
+    [[nodiscard]] double getMeanEvaluationTime() const;
+
+    void clear();
+
+private:
+    // A BEAGLE instance, or a PruningEngine, for the patterns of one subset
+    struct Instance {
+        unsigned subset;
+        unsigned first_pattern;
+        unsigned npatterns;
+        unsigned ncategories;
+        Model::SharedPtr model;
+        unsigned long model_version;// of the parameters last sent to the instance
+        unsigned long eigen_version;
+        int beagle;
+        PruningEngine<double>::SharedPtr native_double;
+        PruningEngine<float>::SharedPtr native_single;
+        std::string resource_name;
+        std::string impl_name;
+        long flags;
+        std::vector<Data::state_t> constant_states;// states every taxon allows, per pattern
+        std::vector<double> invariable_likelihoods;// per pattern, at rate zero
+        std::vector<double> site_log_likelihoods;// per pattern, including invariable sites once combined
+        double log_likelihood;
+    };
+
+    [[nodiscard]] bool isInitialised() const { return !_instances.empty(); }
+
+    [[nodiscard]] static bool usesNative(const Instance &instance) { return instance.native_double || instance.native_single; }
+
+    template<typename Function>
+    static auto withNative(const Instance &instance, Function fn);
+
+    [[nodiscard]] Model::SharedPtr getSubsetModel(unsigned subset) const;
+
+    void checkBeagle(int code, const char *what) const;
+
+    void createInstance(Instance &instance, unsigned ninternal_buffers, unsigned nscalers);
+
+    void createBeagleInstance(Instance &instance, unsigned ncompact, unsigned ninternal_buffers, unsigned nscalers);
+
+    [[nodiscard]] std::string describeInstance(const Instance &instance) const;
+
+    void setTipData(Instance &instance);
+
+    void setPatternWeights(const Instance &instance);
+
+    void setModelParameters(Instance &instance);
+
+    bool refreshModels();
+
+    [[nodiscard]] bool isBoundTo(const Tree &tree) const;
+
+    void markChangedPartials(const Tree &tree);
+
+    void defineOperations(const Tree &tree);
+
+    void updateTransitionMatrices(const Instance &instance);
+
+    void calculatePartials(const Instance &instance);
+
+    double calcRootLogLikelihood(Instance &instance, const Tree &tree);
+
+    void fetchSiteLogLikelihoods(Instance &instance);
+
+    double addInvariableSites(Instance &instance);
+
+    static void flipBuffers(int number, std::vector<unsigned char> &slots, std::vector<int> &flipped);
+
+    [[nodiscard]] int partialsIndex(int number) const;
+
+    [[nodiscard]] int scalerIndex(int number) const;
+
+    [[nodiscard]] int tmatrixIndex(int number) const;
+
+    void mapLeavesToData();
+
+    Data::SharedPtr _data;
+    std::vector<std::string> _taxon_names;// of the tree's leaves, by leaf number
+    std::vector<unsigned> _leaf_rows;     // data row of each leaf
+    Model::SharedPtr _model;
+    std::vector<Model::SharedPtr> _subset_models;// overrides _model where set
+    std::string _implementation;
+    unsigned _nthreads;
+    bool _single_precision;
+
+    std::vector<Instance> _instances;
+    std::vector<std::vector<unsigned>> _worker_instances;// instances evaluated by each worker thread
+    WorkerPool _workers;                                 // started with the instances, reused by every evaluation
+    unsigned _beagle_threads;                            // per instance, for the "threaded" implementation
+    unsigned _ntips;
+    unsigned _nnodes;
+    unsigned _nstates;
+
+    // Which of its two buffers each node number currently uses (bit 0), and
+    // whether it switched since the last accepted state (bit 1). Shared by
+    // all instances, which always compute the same nodes.
+    unsigned long _serial;
+    unsigned long _bound_tree;// serial of the tree the flags were last cleared for, 0 if none
+    std::vector<unsigned char> _partials_slot;
+    std::vector<unsigned char> _tmatrix_slot;
+    std::vector<int> _flipped_partials;
+    std::vector<int> _flipped_tmatrices;
+
+    // Edge length each transition matrix buffer was last computed for (NaN if
+    // none), valid until a model changes
+    std::vector<double> _tmatrix_lengths;
+
+    // Children each partials buffer was last computed from, by partials index
+    struct PartialsSignature {
+        int left;
+        int right;
+        double left_length;
+        double right_length;
+    };
+    std::vector<PartialsSignature> _signatures;
+
+    // Work queued for the current evaluation
+    std::vector<BeagleOperation> _operations;
+    std::vector<PruningOperation> _native_operations;// the same, for native instances
+    std::vector<int> _pmatrix_indices;
+    std::vector<double> _edge_lengths;
+    std::vector<int> _scaler_indices;
+
+    unsigned long _nevaluations;
+    unsigned long _npartials_updates;
+    double _evaluation_seconds;
+
+public:
+    typedef std::shared_ptr<Likelihood> SharedPtr;
+};
+
+inline Likelihood::Likelihood() {
+    static std::atomic<unsigned long> next_serial(1);
+    _serial = next_serial++;
+    _bound_tree = 0;
+    _implementation = "auto";
+    _nthreads = 1;
+    _single_precision = false;
+    clear();
+}
+
+inline Likelihood::~Likelihood() {
+    finalizeBeagleLib();
+}
+
+inline void Likelihood::clear() {
+    finalizeBeagleLib();
+    _data = nullptr;
+    _taxon_names.clear();
+    _leaf_rows.clear();
+    _model = nullptr;
+    _subset_models.clear();
+    _worker_instances.clear();
+    _beagle_threads = 1;
+    _ntips = 0;
+    _nnodes = 0;
+    _nstates = 0;
+    _partials_slot.clear();
+    _tmatrix_slot.clear();
+    _flipped_partials.clear();
+    _flipped_tmatrices.clear();
+    _tmatrix_lengths.clear();
+    _signatures.clear();
+    _operations.clear();
+    _native_operations.clear();
+    _pmatrix_indices.clear();
+    _edge_lengths.clear();
+    _scaler_indices.clear();
+    _nevaluations = 0;
+    _npartials_updates = 0;
+    _evaluation_seconds = 0.0;
+}
+
+inline void Likelihood::setData(Data::SharedPtr data) {
+    if (isInitialised()) {
+        throw XStrom("Cannot change the data of an initialised likelihood");
+    }
+    _data = data;
+}
+
+/*
+ * Names of the taxa of the trees to be evaluated, indexed by leaf number
+ * (the order of the tree file's TAXA block or translate table). Leaves are
+ * matched to the rows of the data by name. Without names, leaf n is taken
+ * to be row n of the data.
+ */
+inline void Likelihood::setTaxonNames(const std::vector<std::string> &names) {
+    if (isInitialised()) {
+        throw XStrom("Cannot change the taxon names of an initialised likelihood");
+    }
+    _taxon_names = names;
+}
+
+// Data row of every leaf, by the name of its taxon
+inline void Likelihood::mapLeavesToData() {
+    _leaf_rows.resize(_ntips);
+    if (_taxon_names.empty()) {
+        std::iota(_leaf_rows.begin(), _leaf_rows.end(), 0u);
+        return;
+    }
+    if (_taxon_names.size() != _ntips) {
+        throw XStrom(fmt::format(FMT_STRING("The trees have {:d} taxa but the data have {:d}"), _taxon_names.size(), _ntips));
+    }
+    const Data::taxon_names_t &data_names = _data->getTaxonNames();
+    std::vector<bool> used(_ntips, false);
+    for (unsigned t = 0; t < _ntips; ++t) {
+        auto iter = std::find(data_names.begin(), data_names.end(), _taxon_names[t]);
+        if (iter == data_names.end()) {
+            throw XStrom(fmt::format(FMT_STRING("Taxon {:s} of the trees is not in the data"), _taxon_names[t]));
+        }
+        auto row = static_cast<unsigned>(iter - data_names.begin());
+        if (used[row]) {
+            throw XStrom(fmt::format(FMT_STRING("Taxon {:s} appears more than once in the trees"), _taxon_names[t]));
+        }
+        used[row] = true;
+        _leaf_rows[t] = row;
+    }
+}
+
+// The model of every subset without one of its own
+inline void Likelihood::setModel(Model::SharedPtr model) {
+    if (isInitialised()) {
+        throw XStrom("Cannot change the model of an initialised likelihood");
+    }
+    _model = model;
+}
+
+inline void Likelihood::setSubsetModel(unsigned subset, Model::SharedPtr model) {
+    if (isInitialised()) {
+        throw XStrom("Cannot change the model of an initialised likelihood");
+    }
+    if (subset >= _subset_models.size()) {
+        _subset_models.resize(subset + 1);
+    }
+    _subset_models[subset] = model;
+}
+
+inline Model::SharedPtr Likelihood::getSubsetModel(unsigned subset) const {
+    return (subset < _subset_models.size() && _subset_models[subset] ? _subset_models[subset] : _model);
+}
+
+/*
+ * One of "auto" (BEAGLE's choice), "cpu" (no vectorisation), "sse", "avx",
+ * "threaded" (CPU implementation using setThreadCount threads) or "native"
+ * (PruningEngine, without BEAGLE).
+ */
+inline void Likelihood::setImplementation(const std::string &implementation) {
+    if (implementation != "auto" && implementation != "cpu" && implementation != "sse" && implementation != "avx" && implementation != "threaded" &&
+        implementation != "native") {
+        throw XStrom(fmt::format(FMT_STRING("Unknown BEAGLE implementation {:s}"), implementation));
+    }
+    _implementation = implementation;
+}
+
+/*
+ * Subsets are evaluated concurrently on up to nthreads threads. With the
+ * "threaded" implementation, threads left over (nthreads beyond the number
+ * of subsets) are shared out among the BEAGLE instances.
+ */
+inline void Likelihood::setThreadCount(unsigned nthreads) {
+    _nthreads = std::max(1u, nthreads);
+}
+
+/*
+ * Single precision halves the memory and bandwidth used by partials, at the
+ * cost of log-likelihoods accurate to about six significant digits.
+ */
+inline void Likelihood::setSinglePrecision(bool single_precision) {
+    if (isInitialised()) {
+        throw XStrom("Cannot change the precision of an initialised likelihood");
+    }
+    _single_precision = single_precision;
+}
+
+template<typename Function>
+inline auto Likelihood::withNative(const Instance &instance, Function fn) {
+    return (instance.native_single ? fn(*instance.native_single) : fn(*instance.native_double));
+}
+
+inline void Likelihood::checkBeagle(int code, const char *what) const {
+    if (code != BEAGLE_SUCCESS) {
+        throw XStrom(fmt::format(FMT_STRING("BEAGLE failed in {:s} (error code {:d})"), what, code));
+    }
+}
+
+inline std::string Likelihood::beagleLibVersion() {
+    return beagleGetVersion();
+}
+
+inline std::string Likelihood::availableResources() const {
+    BeagleResourceList *resources = beagleGetResourceList();
+    std::string s;
+    for (int i = 0; i < resources->length; ++i) {
+        s += fmt::format(FMT_STRING("  resource {:d}: {:s} ({:s})\n"), i, resources->list[i].name, resources->list[i].description);
+    }
+    return s;
+}
+
+inline std::string Likelihood::describeInstance(const Instance &instance) const {
+    if (usesNative(instance)) {
+        return withNative(instance, [this](auto &engine) {
+            return fmt::format(FMT_STRING("native pruning engine ({:s}, {:s} precision, {:d} patterns rescaled)"), engine.getKernelName(),
+                               _single_precision ? "single" : "double", engine.getNumRescaledPatterns());
+        });
+    }
+    std::vector<std::string> features;
+    if (instance.flags & BEAGLE_FLAG_PRECISION_SINGLE) {
+        features.emplace_back("single precision");
+    }
+    if (instance.flags & BEAGLE_FLAG_PRECISION_DOUBLE) {
+        features.emplace_back("double precision");
+    }
+    if (instance.flags & BEAGLE_FLAG_VECTOR_AVX) {
+        features.emplace_back("AVX");
+    }
+    if (instance.flags & BEAGLE_FLAG_VECTOR_SSE) {
+        features.emplace_back("SSE");
+    }
+    if (instance.flags & BEAGLE_FLAG_THREADING_CPP) {
+        features.emplace_back(fmt::format(FMT_STRING("{:d} threads"), _beagle_threads));
+    }
+    if (instance.flags & BEAGLE_FLAG_PROCESSOR_GPU) {
+        features.emplace_back("GPU");
+    }
+    return fmt::format(FMT_STRING("{:s} on {:s} ({})"), instance.impl_name, instance.resource_name, fmt::join(features, ", "));
+}
+
+inline std::string Likelihood::usedResources() const {
+    if (!isInitialised()) {
+        return "BEAGLE not initialised";
+    }
+    if (_instances.size() == 1) {
+        return describeInstance(_instances[0]);
+    }
+    std::vector<std::string> descriptions;
+    for (auto &instance : _instances) {
+        descriptions.push_back(describeInstance(instance));
+    }
+    std::sort(descriptions.begin(), descriptions.end());
+    descriptions.erase(std::unique(descriptions.begin(), descriptions.end()), descriptions.end());
+    return fmt::format(FMT_STRING("{:d} subsets on {:d} threads: {}"), _instances.size(), _worker_instances.size(), fmt::join(descriptions, "; "));
+}
+
+inline double Likelihood::getMeanEvaluationTime() const {
+    return (_nevaluations > 0 ? _evaluation_seconds / static_cast<double>(_nevaluations) : 0.0);
+}
+
+/*
+ * Create an instance per data subset. Buffer counts come from the tree: a
+ * partials (or compact tip state) buffer per leaf, and two partials buffers,
+ * two scale buffers and two transition matrices per other node, plus one
+ * scale buffer for the cumulative scale factors. Leaves keep two transition
+ * matrices because their edges change too. Instances are assigned to worker
+ * threads to balance their cost per evaluation, which is proportional to
+ * patterns x categories x states^2. The worker threads are started here and
+ * kept until the instances are finalised, since an evaluation after a small
+ * change takes less time than starting them would.
+ */
+inline void Likelihood::initBeagleLib(const Tree &tree) {
+    if (!_data) {
+        throw XStrom("Likelihood needs data before BEAGLE is initialised");
+    }
+    finalizeBeagleLib();
+
+    _ntips = _data->getNumTaxa();
+    if (tree.numLeaves() != _ntips) {
+        throw XStrom(fmt::format(FMT_STRING("Tree has {:d} leaves but the data have {:d} taxa"), tree.numLeaves(), _ntips));
+    }
+    _nnodes = std::max(tree.numNodes(), tree.numLeaves() + tree.numInternals());
+    _nstates = _data->getNumStates();
+    mapLeavesToData();
+
+    unsigned nsubsets = _data->getNumSubsets();
+    if (_subset_models.size() > nsubsets) {
+        throw XStrom(fmt::format(FMT_STRING("A model was given for subset {:d}, but the data have {:d} subsets"), _subset_models.size(), nsubsets));
+    }
+    std::vector<Instance> instances(nsubsets);
+    std::vector<double> costs(nsubsets);
+    for (unsigned k = 0; k < nsubsets; ++k) {
+        Instance &instance = instances[k];
+        instance.subset = k;
+        instance.first_pattern = _data->getSubsetBegin(k);
+        instance.npatterns = _data->getSubsetEnd(k) - instance.first_pattern;
+        instance.model = getSubsetModel(k);
+        instance.ncategories = (instance.model ? instance.model->getNumCategories() : 0);
+        instance.model_version = 0;
+        instance.eigen_version = 0;
+        instance.beagle = -1;
+        instance.flags = 0;
+        instance.log_likelihood = 0.0;
+        if (!instance.model) {
+            throw XStrom(fmt::format(FMT_STRING("Likelihood needs a model for subset {:s} before BEAGLE is initialised"), _data->getSubsetNames()[k]));
+        }
+        if (instance.model->getNumStates() != _nstates) {
+            throw XStrom(fmt::format(FMT_STRING("Model of subset {:s} has {:d} states but the data have {:d}"), _data->getSubsetNames()[k],
+                                     instance.model->getNumStates(), _nstates));
+        }
+        costs[k] = static_cast<double>(instance.npatterns) * instance.model->getNumCategories() * _nstates * _nstates;
+    }
+    _worker_instances = balanceByCost(costs, _nthreads);
+    _beagle_threads = std::max(1u, _nthreads / static_cast<unsigned>(_worker_instances.size()));
+
+    unsigned ninternal_buffers = _nnodes - _ntips;
+    unsigned nscalers = 2 * ninternal_buffers + 1;
+    _instances = std::move(instances);
+    try {
+        for (auto &instance : _instances) {
+            createInstance(instance, ninternal_buffers, nscalers);
+            setTipData(instance);
+            setPatternWeights(instance);
+            setModelParameters(instance);
+        }
+    } catch (...) {
+        finalizeBeagleLib();
+        throw;
+    }
+    _bound_tree = 0;
+    _partials_slot.assign(_nnodes, 0);
+    _tmatrix_slot.assign(_nnodes, 0);
+    _flipped_partials.clear();
+    _flipped_tmatrices.clear();
+    _tmatrix_lengths.assign(2 * _nnodes, std::numeric_limits<double>::quiet_NaN());
+    _signatures.assign(2 * _nnodes, {-1, -1, 0.0, 0.0});
+    _workers.start(static_cast<unsigned>(_worker_instances.size()));
+}
+
+// Taxa without ambiguous states in the subset are stored compactly by BEAGLE, as state codes
+inline void Likelihood::createInstance(Instance &instance, unsigned ninternal_buffers, unsigned nscalers) {
+    if (_implementation != "native") {
+        unsigned ncompact = 0;
+        for (unsigned t = 0; t < _ntips; ++t) {
+            const Data::state_t *states = _data->getTaxonPatterns(_leaf_rows[t]) + instance.first_pattern;
+            bool unambiguous = true;
+            for (unsigned p = 0; p < instance.npatterns && unambiguous; ++p) {
+                Data::state_t s = states[p];
+                unambiguous = ((s & (s - 1)) == 0 || s == _data->getMissingState());
+            }
+            ncompact += unambiguous;
+        }
+        createBeagleInstance(instance, ncompact, ninternal_buffers, nscalers);
+        return;
+    }
+
+    if (_single_precision) {
+        instance.native_single = std::make_shared<PruningEngine<float>>();
+    } else {
+        instance.native_double = std::make_shared<PruningEngine<double>>();
+    }
+    withNative(instance, [&](auto &engine) {
+        engine.createInstance(_ntips, _ntips + 2 * ninternal_buffers, _nstates, instance.npatterns, 2 * _nnodes, instance.ncategories, nscalers);
+    });
+    instance.resource_name = "CPU";
+    instance.impl_name = "native";
+    instance.flags = BEAGLE_FLAG_PROCESSOR_CPU | (_single_precision ? BEAGLE_FLAG_PRECISION_SINGLE : BEAGLE_FLAG_PRECISION_DOUBLE);
+}
+
+inline void Likelihood::createBeagleInstance(Instance &instance, unsigned ncompact, unsigned ninternal_buffers, unsigned nscalers) {
+    long preference_flags = BEAGLE_FLAG_PROCESSOR_CPU;
+    long requirement_flags = (_single_precision ? BEAGLE_FLAG_PRECISION_SINGLE : BEAGLE_FLAG_PRECISION_DOUBLE) | BEAGLE_FLAG_SCALING_MANUAL;
+    if (_implementation == "cpu") {
+        requirement_flags |= BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_VECTOR_NONE;
+    } else if (_implementation == "sse") {
+        requirement_flags |= BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_VECTOR_SSE;
+    } else if (_implementation == "avx") {
+        requirement_flags |= BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_VECTOR_AVX;
+    } else if (_implementation == "threaded") {
+        requirement_flags |= BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_THREADING_CPP;
+    }
+
+    BeagleInstanceDetails details;
+    instance.beagle = beagleCreateInstance(
+            static_cast<int>(_ntips),
+            static_cast<int>(_ntips + 2 * ninternal_buffers - ncompact),
+            static_cast<int>(ncompact),
+            static_cast<int>(_nstates),
+            static_cast<int>(instance.npatterns),
+            1,
+            static_cast<int>(2 * _nnodes),
+            static_cast<int>(instance.ncategories),
+            static_cast<int>(nscalers),
+            nullptr,
+            0,
+            preference_flags,
+            requirement_flags,
+            &details);
+    if (instance.beagle < 0) {
+        instance.beagle = -1;
+        throw XStrom(fmt::format(FMT_STRING("Could not create a BEAGLE instance for implementation {:s}"), _implementation));
+    }
+    instance.resource_name = details.resourceName;
+    instance.impl_name = details.implName;
+    instance.flags = details.flags;
+
+    if (_implementation == "threaded") {
+        checkBeagle(beagleSetCPUThreadCount(instance.beagle, static_cast<int>(_beagle_threads)), "beagleSetCPUThreadCount");
+    }
+}
+
+inline void Likelihood::finalizeBeagleLib() {
+    _workers.stop();
+    for (auto &instance : _instances) {
+        if (instance.beagle >= 0) {
+            beagleFinalizeInstance(instance.beagle);
+        }
+    }
+    _instances.clear();
+}
+
+/*
+ * Unambiguous taxa get state codes, with the code nstates for missing data;
+ * the others get partials with 1.0 for every state allowed at a pattern. The
+ * states allowed by every taxon are kept for invariable sites.
+ */
+inline void Likelihood::setTipData(Instance &instance) {
+    Data::state_t missing = _data->getMissingState();
+    unsigned npatterns = instance.npatterns;
+    instance.constant_states.assign(npatterns, missing);
+    std::vector<int> codes(npatterns);
+    std::vector<double> partials(static_cast<std::size_t>(npatterns) * _nstates);
+    for (unsigned t = 0; t < _ntips; ++t) {
+        const Data::state_t *states = _data->getTaxonPatterns(_leaf_rows[t]) + instance.first_pattern;
+        bool unambiguous = true;
+        for (unsigned p = 0; p < npatterns; ++p) {
+            Data::state_t s = states[p];
+            instance.constant_states[p] &= s;
+            if (s == missing) {
+                codes[p] = static_cast<int>(_nstates);
+            } else if ((s & (s - 1)) == 0) {
+                int code = 0;
+                while (!(s & (Data::state_t(1) << code))) {
+                    ++code;
+                }
+                codes[p] = code;
+            } else {
+                unambiguous = false;
+            }
+            for (unsigned k = 0; k < _nstates; ++k) {
+                partials[static_cast<std::size_t>(p) * _nstates + k] = (s & (Data::state_t(1) << k)) ? 1.0 : 0.0;
+            }
+        }
+        if (usesNative(instance)) {
+            withNative(instance, [&](auto &engine) { engine.setTipPartials(t, partials.data()); });
+        } else if (unambiguous) {
+            checkBeagle(beagleSetTipStates(instance.beagle, static_cast<int>(t), codes.data()), "beagleSetTipStates");
+        } else {
+            checkBeagle(beagleSetTipPartials(instance.beagle, static_cast<int>(t), partials.data()), "beagleSetTipPartials");
+        }
+    }
+}
+
+inline void Likelihood::setPatternWeights(const Instance &instance) {
+    const Data::pattern_counts_t &counts = _data->getPatternCounts();
+    std::vector<double> weights(counts.begin() + instance.first_pattern, counts.begin() + instance.first_pattern + instance.npatterns);
+    if (usesNative(instance)) {
+        withNative(instance, [&](auto &engine) { engine.setPatternWeights(weights.data()); });
+        return;
+    }
+    checkBeagle(beagleSetPatternWeights(instance.beagle, weights.data()), "beagleSetPatternWeights");
+}
+
+/*
+ * Send the model to the instance. The eigendecomposition is sent only if it
+ * changed since it was last sent. The subset's relative rate scales all of
+ * its category rates. With invariable sites, the likelihood of each pattern
+ * at rate zero (the frequency of the states every taxon allows) is computed
+ * here, once per change of the model.
+ */
+inline void Likelihood::setModelParameters(Instance &instance) {
+    const Model &model = *instance.model;
+    if (model.getNumStates() != _nstates || model.getNumCategories() != instance.ncategories) {
+        throw XStrom("Cannot change the number of states or rate categories of a model used by an initialised likelihood");
+    }
+    bool eigen_changed = (model.getEigenVersion() != instance.eigen_version);
+    std::vector<double> rates = model.getCategoryRates();
+    for (double &rate : rates) {
+        rate *= model.getSubsetRelativeRate();
+    }
+    if (usesNative(instance)) {
+        withNative(instance, [&](auto &engine) {
+            engine.setStateFrequencies(model.getStateFreqs().data());
+            if (eigen_changed) {
+                engine.setEigenDecomposition(model.getEigenVectors().data(), model.getInverseEigenVectors().data(), model.getEigenValues().data());
+            }
+            engine.setCategoryRates(rates.data());
+            engine.setCategoryWeights(model.getCategoryWeights().data());
+        });
+    } else {
+        checkBeagle(beagleSetStateFrequencies(instance.beagle, 0, model.getStateFreqs().data()), "beagleSetStateFrequencies");
+        if (eigen_changed) {
+            checkBeagle(beagleSetEigenDecomposition(instance.beagle, 0, model.getEigenVectors().data(), model.getInverseEigenVectors().data(),
+                                                    model.getEigenValues().data()),
+                        "beagleSetEigenDecomposition");
+        }
+        checkBeagle(beagleSetCategoryRates(instance.beagle, rates.data()), "beagleSetCategoryRates");
+        checkBeagle(beagleSetCategoryWeights(instance.beagle, 0, model.getCategoryWeights().data()), "beagleSetCategoryWeights");
+    }
+    instance.invariable_likelihoods.clear();
+    if (model.getProportionInvariable() > 0.0) {
+        const std::vector<double> &freqs = model.getStateFreqs();
+        instance.invariable_likelihoods.assign(instance.npatterns, 0.0);
+        for (unsigned p = 0; p < instance.npatterns; ++p) {
+            for (unsigned k = 0; k < _nstates; ++k) {
+                if (instance.constant_states[p] & (Data::state_t(1) << k)) {
+                    instance.invariable_likelihoods[p] += freqs[k];
+                }
+            }
+        }
+    }
+    instance.model_version = model.getVersion();
+    instance.eigen_version = model.getEigenVersion();
+}
+
+/*
+ * Send every model whose parameters changed since the last evaluation. All
+ * cached transition matrices are then stale, since instances share them by
+ * edge length.
+ */
+inline bool Likelihood::refreshModels() {
+    bool changed = false;
+    for (auto &instance : _instances) {
+        if (instance.model->getVersion() != instance.model_version) {
+            setModelParameters(instance);
+            changed = true;
+        }
+    }
+    if (changed) {
+        std::fill(_tmatrix_lengths.begin(), _tmatrix_lengths.end(), std::numeric_limits<double>::quiet_NaN());
+    }
+    return changed;
+}
+
+inline int Likelihood::partialsIndex(int number) const {
+    if (number < static_cast<int>(_ntips)) {
+        return number;
+    }
+    return (_partials_slot[number] & 1 ? number + static_cast<int>(_nnodes - _ntips) : number);
+}
+
+inline int Likelihood::scalerIndex(int number) const {
+    int scaler = number - static_cast<int>(_ntips);
+    return (_partials_slot[number] & 1 ? scaler + static_cast<int>(_nnodes - _ntips) : scaler);
+}
+
+inline int Likelihood::tmatrixIndex(int number) const {
+    return (_tmatrix_slot[number] & 1 ? number + static_cast<int>(_nnodes) : number);
+}
+
+/*
+ * Switch a node to its other buffer, unless it already switched since the
+ * last accepted state: its original buffer must then stay untouched.
+ */
+inline void Likelihood::flipBuffers(int number, std::vector<unsigned char> &slots, std::vector<int> &flipped) {
+    if (!(slots[number] & 2)) {
+        slots[number] ^= 3;
+        flipped.push_back(number);
+    }
+}
+
+/*
+ * Whether the dirty flags of the tree describe its changes since this
+ * Likelihood last evaluated it: it was the last tree evaluated here and no
+ * other Likelihood has cleared its flags since.
+ */
+inline bool Likelihood::isBoundTo(const Tree &tree) const {
+    return (_bound_tree != 0 && tree._serial == _bound_tree && tree._likelihood_serial == _serial);
+}
+
+/*
+ * Set the dirty flags of a tree evaluated for the first time. Every edge is
+ * flagged, since matrices already computed for its length are found anyway.
+ * Working up from the leaves, a node is clean if its current buffer was
+ * computed from the same two children, in either order, with the same edge
+ * lengths, and both children are clean. Buffers are indexed by node number,
+ * so this finds the subtrees a tree shares with the trees evaluated before.
+ */
+inline void Likelihood::markChangedPartials(const Tree &tree) {
+    for (auto nd : ranges::views::reverse(tree._preorder)) {
+        nd->_tmatrix_dirty = true;
+        Node *lchild = nd->_left_child;
+        if (!lchild) {
+            nd->_partials_dirty = false;
+            continue;
+        }
+        Node *rchild = lchild->_right_sib;
+        if (!rchild || rchild->_right_sib || lchild->_partials_dirty || rchild->_partials_dirty) {
+            nd->_partials_dirty = true;
+            continue;
+        }
+        const PartialsSignature &signature = _signatures[partialsIndex(nd->_number)];
+        bool same = (signature.left == lchild->_number && signature.right == rchild->_number && signature.left_length == lchild->_edge_length &&
+                     signature.right_length == rchild->_edge_length);
+        bool swapped = (signature.left == rchild->_number && signature.right == lchild->_number && signature.left_length == rchild->_edge_length &&
+                        signature.right_length == lchild->_edge_length);
+        nd->_partials_dirty = !(same || swapped);
+    }
+}
+
+/*
+ * Queue a transition matrix for every dirty edge and a partials operation
+ * for every dirty node below the root, children before parents, and clear
+ * the flags. A dirty edge whose current matrix buffer was computed for the
+ * same length needs nothing, and one whose spare buffer was is switched to
+ * it; all other matrices are computed in a single batch. The scalers of all
+ * internal nodes are listed, since the cumulative scale factors are summed
+ * afresh each time. Only bifurcating nodes are supported; this is checked
+ * before anything is changed.
+ */
+inline void Likelihood::defineOperations(const Tree &tree) {
+    if (tree.numLeaves() != _ntips || tree.numNodes() > _nnodes) {
+        throw XStrom("Tree does not fit the BEAGLE instance it was initialised with");
+    }
+    for (auto nd : tree._preorder) {
+        if (nd->_left_child && (!nd->_left_child->_right_sib || nd->_left_child->_right_sib->_right_sib)) {
+            throw XStrom(fmt::format(FMT_STRING("Likelihood needs a bifurcating tree, but node {:d} has a polytomy"), nd->_number));
+        }
+    }
+    _operations.clear();
+    _native_operations.clear();
+    _pmatrix_indices.clear();
+    _edge_lengths.clear();
+    _scaler_indices.clear();
+
+    for (auto nd : tree._preorder) {
+        if (!nd->_tmatrix_dirty) {
+            continue;
+        }
+        nd->_tmatrix_dirty = false;
+        int number = nd->_number;
+        if (_tmatrix_lengths[tmatrixIndex(number)] == nd->_edge_length) {
+            continue;
+        }
+        int spare = (_tmatrix_slot[number] & 1 ? number : number + static_cast<int>(_nnodes));
+        bool reuse_spare = (!(_tmatrix_slot[number] & 2) && _tmatrix_lengths[spare] == nd->_edge_length);
+        flipBuffers(number, _tmatrix_slot, _flipped_tmatrices);
+        if (!reuse_spare) {
+            _pmatrix_indices.push_back(tmatrixIndex(number));
+            _edge_lengths.push_back(nd->_edge_length);
+            _tmatrix_lengths[tmatrixIndex(number)] = nd->_edge_length;
+        }
+    }
+
+    for (auto nd : ranges::views::reverse(tree._preorder)) {
+        if (!nd->_left_child) {
+            continue;
+        }
+        if (nd->_partials_dirty) {
+            flipBuffers(nd->_number, _partials_slot, _flipped_partials);
+            Node *lchild = nd->_left_child;
+            Node *rchild = lchild->_right_sib;
+            _operations.push_back({partialsIndex(nd->_number), scalerIndex(nd->_number), BEAGLE_OP_NONE,
+                                   partialsIndex(lchild->_number), tmatrixIndex(lchild->_number),
+                                   partialsIndex(rchild->_number), tmatrixIndex(rchild->_number)});
+            if (_implementation == "native") {
+                _native_operations.push_back({partialsIndex(nd->_number), scalerIndex(nd->_number), partialsIndex(lchild->_number),
+                                              tmatrixIndex(lchild->_number), partialsIndex(rchild->_number), tmatrixIndex(rchild->_number)});
+            }
+            _signatures[partialsIndex(nd->_number)] = {lchild->_number, rchild->_number, lchild->_edge_length, rchild->_edge_length};
+            nd->_partials_dirty = false;
+        }
+        _scaler_indices.push_back(scalerIndex(nd->_number));
+    }
+    tree._root->_partials_dirty = false;
+    tree._root->_tmatrix_dirty = false;
+}
+
+inline void Likelihood::updateTransitionMatrices(const Instance &instance) {
+    if (_pmatrix_indices.empty()) {
+        return;
+    }
+    if (usesNative(instance)) {
+        withNative(instance, [this](auto &engine) {
+            engine.updateTransitionMatrices(_pmatrix_indices.data(), _edge_lengths.data(), static_cast<int>(_pmatrix_indices.size()));
+        });
+        return;
+    }
+    checkBeagle(beagleUpdateTransitionMatrices(instance.beagle, 0, _pmatrix_indices.data(), nullptr, nullptr, _edge_lengths.data(),
+                                               static_cast<int>(_pmatrix_indices.size())),
+                "beagleUpdateTransitionMatrices");
+}
+
+inline void Likelihood::calculatePartials(const Instance &instance) {
+    if (_operations.empty()) {
+        return;
+    }
+    if (usesNative(instance)) {
+        withNative(instance, [this](auto &engine) { engine.updatePartials(_native_operations.data(), static_cast<int>(_native_operations.size())); });
+        return;
+    }
+    checkBeagle(beagleUpdatePartials(instance.beagle, _operations.data(), static_cast<int>(_operations.size()), BEAGLE_OP_NONE), "beagleUpdatePartials");
+}
+
+/*
+ * Every partials operation rescales its output, and the log scale factors of
+ * all internal nodes are summed into the cumulative scale buffer.
+ */
+inline double Likelihood::calcRootLogLikelihood(Instance &instance, const Tree &tree) {
+    int cumulative = static_cast<int>(2 * (_nnodes - _ntips));
+    if (usesNative(instance)) {
+        withNative(instance, [&](auto &engine) {
+            engine.resetScaleFactors(cumulative);
+            engine.accumulateScaleFactors(_scaler_indices.data(), static_cast<int>(_scaler_indices.size()), cumulative);
+        });
+    } else {
+        checkBeagle(beagleResetScaleFactors(instance.beagle, cumulative), "beagleResetScaleFactors");
+        checkBeagle(beagleAccumulateScaleFactors(instance.beagle, _scaler_indices.data(), static_cast<int>(_scaler_indices.size()), cumulative),
+                    "beagleAccumulateScaleFactors");
+    }
+
+    Node *root = tree._root;
+    Node *child = root->_left_child;
+    int state_freqs = 0;
+    int category_weights = 0;
+    int root_partials = partialsIndex(root->_number);
+    int child_partials = partialsIndex(child->_number);
+    int child_tmatrix = tmatrixIndex(child->_number);
+    double log_likelihood = 0.0;
+    if (usesNative(instance)) {
+        log_likelihood = withNative(instance, [&](auto &engine) {
+            return (tree.isRooted() ? engine.calcRootLogLikelihood(child_partials, cumulative)
+                                    : engine.calcEdgeLogLikelihood(root_partials, child_partials, child_tmatrix, cumulative));
+        });
+    } else if (tree.isRooted()) {
+        checkBeagle(beagleCalculateRootLogLikelihoods(instance.beagle, &child_partials, &category_weights, &state_freqs, &cumulative, 1, &log_likelihood),
+                    "beagleCalculateRootLogLikelihoods");
+    } else {
+        checkBeagle(beagleCalculateEdgeLogLikelihoods(instance.beagle, &root_partials, &child_partials, &child_tmatrix, nullptr, nullptr,
+                                                      &category_weights, &state_freqs, &cumulative, 1, &log_likelihood, nullptr, nullptr),
+                    "beagleCalculateEdgeLogLikelihoods");
+    }
+    return (instance.invariable_likelihoods.empty() ? log_likelihood : addInvariableSites(instance));
+}
+
+// Unweighted log-likelihood of each pattern from the instance's last root or edge calculation
+inline void Likelihood::fetchSiteLogLikelihoods(Instance &instance) {
+    instance.site_log_likelihoods.resize(instance.npatterns);
+    if (usesNative(instance)) {
+        withNative(instance, [&](auto &engine) { engine.getSiteLogLikelihoods(instance.site_log_likelihoods.data()); });
+    } else {
+        checkBeagle(beagleGetSiteLogLikelihoods(instance.beagle, instance.site_log_likelihoods.data()), "beagleGetSiteLogLikelihoods");
+    }
+}
+
+/*
+ * The site likelihoods computed so far are those of the variable sites.
+ * Each becomes (1 - pinvar) L + pinvar I, where I is the pattern's
+ * likelihood at rate zero; the sum is taken in log space, since L is
+ * usually far smaller than I.
+ */
+inline double Likelihood::addInvariableSites(Instance &instance) {
+    fetchSiteLogLikelihoods(instance);
+    double pinvar = instance.model->getProportionInvariable();
+    double log_variable = std::log1p(-pinvar);
+    double log_pinvar = std::log(pinvar);
+    const Data::pattern_counts_t &counts = _data->getPatternCounts();
+    double log_likelihood = 0.0;
+    for (unsigned p = 0; p < instance.npatterns; ++p) {
+        double site = log_variable + instance.site_log_likelihoods[p];
+        double invariable = instance.invariable_likelihoods[p];
+        if (invariable > 0.0) {
+            double x = log_pinvar + std::log(invariable);
+            site = std::max(site, x) + std::log1p(std::exp(-std::fabs(site - x)));
+        }
+        instance.site_log_likelihoods[p] = site;
+        log_likelihood += counts[instance.first_pattern + p] * site;
+    }
+    return log_likelihood;
+}
+
+/*
+ * The first evaluation of a tree computes what its buffers do not already
+ * hold and is accepted straight away; later ones recompute only what the
+ * tree has flagged dirty. A tree evaluated by another Likelihood in between
+ * counts as a first evaluation again, since that one cleared the flags.
+ * The subsets are evaluated by their worker threads and summed in subset
+ * order, so the result does not depend on the number of threads.
+ */
+inline double Likelihood::calcLogLikelihood(const Tree &tree) {
+    if (!isInitialised()) {
+        initBeagleLib(tree);
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    Node *child = tree._root ? tree._root->_left_child : nullptr;
+    if (!child || child->_right_sib) {
+        throw XStrom("Likelihood needs a tree whose root has a single child");
+    }
+    bool first_evaluation = !isBoundTo(tree);
+    if (refreshModels()) {
+        for (auto nd : tree._preorder) {
+            nd->_partials_dirty = true;
+            nd->_tmatrix_dirty = true;
+        }
+    } else if (first_evaluation) {
+        markChangedPartials(tree);
+    }
+    _bound_tree = tree._serial;
+    tree._likelihood_serial = _serial;
+    defineOperations(tree);
+    _npartials_updates += _operations.size();
+    _workers.run([&](unsigned worker) {
+        for (unsigned k : _worker_instances[worker]) {
+            Instance &instance = _instances[k];
+            updateTransitionMatrices(instance);
+            calculatePartials(instance);
+            instance.log_likelihood = calcRootLogLikelihood(instance, tree);
+        }
+    });
+    double log_likelihood = 0.0;
+    for (auto &instance : _instances) {
+        log_likelihood += instance.log_likelihood;
+    }
+    if (first_evaluation) {
+        acceptProposal();
+    }
+
+    _evaluation_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++_nevaluations;
+    return log_likelihood;
+}
+
+/*
+ * Unweighted log-likelihood of every pattern, in the pattern order of Data,
+ * from the most recent calcLogLikelihood (so after revertProposal they are
+ * still those of the rejected proposal). Weighted by the pattern counts they
+ * sum to that log-likelihood. Instances with invariable sites kept their
+ * combined values when they were evaluated; the others are fetched now.
+ */
+inline void Likelihood::getPatternLogLikelihoods(std::vector<double> &log_likelihoods) {
+    if (!isInitialised() || _bound_tree == 0) {
+        throw XStrom("Pattern log-likelihoods requested before any log-likelihood was computed");
+    }
+    log_likelihoods.resize(_data->getNumPatterns());
+    for (auto &instance : _instances) {
+        if (instance.invariable_likelihoods.empty()) {
+            fetchSiteLogLikelihoods(instance);
+        }
+        std::copy(instance.site_log_likelihoods.begin(), instance.site_log_likelihoods.end(), log_likelihoods.begin() + instance.first_pattern);
+    }
+}
+
+/*
+ * Forget what every buffer was computed from, so that the next evaluation
+ * recomputes all transition matrices and partials (for timing full
+ * evaluations).
+ */
+inline void Likelihood::invalidateBuffers() {
+    _bound_tree = 0;
+    std::fill(_tmatrix_lengths.begin(), _tmatrix_lengths.end(), std::numeric_limits<double>::quiet_NaN());
+    std::fill(_signatures.begin(), _signatures.end(), PartialsSignature{-1, -1, 0.0, 0.0});
+}
+
+/*
+ * Keep the buffers written since the last accepted state.
+ */
+inline void Likelihood::acceptProposal() {
+    for (int number : _flipped_partials) {
+        _partials_slot[number] &= 1;
+    }
+    for (int number : _flipped_tmatrices) {
+        _tmatrix_slot[number] &= 1;
+    }
+    _flipped_partials.clear();
+    _flipped_tmatrices.clear();
+}
+
+/*
+ * Switch back to the buffers of the last accepted state. The caller must
+ * first restore the tree itself (edge lengths and topology); the dirty flags
+ * raised by doing so are cleared, as the restored buffers match it again.
+ */
+inline void Likelihood::revertProposal(const Tree &tree) {
+    if (!isBoundTo(tree)) {
+        throw XStrom("Cannot revert a proposal on a tree that was not the last one evaluated");
+    }
+    for (int number : _flipped_partials) {
+        _partials_slot[number] ^= 3;
+    }
+    for (int number : _flipped_tmatrices) {
+        _tmatrix_slot[number] ^= 3;
+    }
+    _flipped_partials.clear();
+    _flipped_tmatrices.clear();
+    for (auto nd : tree._preorder) {
+        nd->_partials_dirty = false;
+        nd->_tmatrix_dirty = false;
+    }
+    tree._root->_partials_dirty = false;
+    tree._root->_tmatrix_dirty = false;
+}
+
+}// namespace strom
@@ -0,0 +1,216 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "gamma.hpp"
+#include "xstrom.hpp"
+
+#include <cmath>
+#include <fmt/format.h>
+#include <memory>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Substitution model in the form BEAGLE consumes: state frequencies, an
+ * eigendecomposition of the instantaneous rate matrix, and discrete rate
+ * categories with their weights. The rate matrix is the equal-rates model
+ * (Jukes-Cantor for nucleotides, Mk in general), scaled so that branch
+ * lengths are expected substitutions per site. Rates may vary across sites
+ * by a discrete gamma distribution (+G) and a proportion of invariable
+ * sites (+I). The categories are those of the variable sites: their weights
+ * sum to 1 and their rates are divided by 1 - pinvar, so that the mean rate
+ * over all sites stays 1; Likelihood adds the invariable sites' share to
+ * each pattern's likelihood. In a partitioned analysis
+ * each subset has its own Model, and its relative rate multiplies every
+ * category rate.
+ *
+ * The eigendecomposition is recomputed only when the rate matrix changes.
+ * Every change of parameters advances the model's version, and changes of
+ * the rate matrix also advance its eigen version, so that a Likelihood can
+ * tell which of its cached values are stale.
+ */
+class Model {
+public:
+    Model();
+
+    void setNumStates(unsigned nstates);
+
+    void setSubsetRelativeRate(double rate);
+
+    void setGammaCategories(unsigned ncategories, bool median = false);
+
+    void setGammaShape(double shape);
+
+    void setProportionInvariable(double pinvar);
+
+    [[nodiscard]] unsigned getNumStates() const { return _nstates; }
+
+    [[nodiscard]] unsigned getNumCategories() const { return static_cast<unsigned>(_category_rates.size()); }
+
+    [[nodiscard]] const std::vector<double> &getStateFreqs() const { return _state_freqs; }
+
+    [[nodiscard]] const std::vector<double> &getEigenVectors() const { return _eigenvectors; }
+
+    [[nodiscard]] const std::vector<double> &getInverseEigenVectors() const { return _inverse_eigenvectors; }
+
+    [[nodiscard]] const std::vector<double> &getEigenValues() const { return _eigenvalues; }
+
+    [[nodiscard]] const std::vector<double> &getCategoryRates() const { return _category_rates; }
+
+    [[nodiscard]] const std::vector<double> &getCategoryWeights() const { return _category_weights; }
+
+    [[nodiscard]] double getSubsetRelativeRate() const { return _subset_relative_rate; }
+
+    [[nodiscard]] double getGammaShape() const { return _gamma_shape; }
+
+    [[nodiscard]] double getProportionInvariable() const { return _pinvar; }
+
+    [[nodiscard]] unsigned long getVersion() const { return _version; }
+
+    [[nodiscard]] unsigned long getEigenVersion() const { return _eigen_version; }
+
+    void clear();
+
+private:
+    void calcEigenSystem();
+
+    void calcCategoryRates();
+
+    unsigned _nstates;
+    std::vector<double> _state_freqs;
+    std::vector<double> _eigenvectors;        // row-major; column j is eigenvector j
+    std::vector<double> _inverse_eigenvectors;// row-major
+    std::vector<double> _eigenvalues;
+    std::vector<double> _category_rates;
+    std::vector<double> _category_weights;
+    double _subset_relative_rate;
+    unsigned _gamma_ncategories;
+    bool _gamma_median;
+    double _gamma_shape;
+    double _pinvar;
+    unsigned long _version;
+    unsigned long _eigen_version;
+
+public:
+    typedef std::shared_ptr<Model> SharedPtr;
+};
+
+inline Model::Model() {
+    _version = 0;
+    _eigen_version = 0;
+    clear();
+}
+
+inline void Model::clear() {
+    _nstates = 0;
+    _state_freqs.clear();
+    _eigenvectors.clear();
+    _inverse_eigenvectors.clear();
+    _eigenvalues.clear();
+    _category_rates = {1.0};
+    _category_weights = {1.0};
+    _subset_relative_rate = 1.0;
+    _gamma_ncategories = 1;
+    _gamma_median = false;
+    _gamma_shape = 1.0;
+    _pinvar = 0.0;
+    ++_version;
+    ++_eigen_version;
+}
+
+inline void Model::setNumStates(unsigned nstates) {
+    if (nstates < 2) {
+        throw XStrom(fmt::format(FMT_STRING("A model needs at least two states, not {:d}"), nstates));
+    }
+    _nstates = nstates;
+    _state_freqs.assign(nstates, 1.0 / nstates);
+    calcEigenSystem();
+    ++_version;
+    ++_eigen_version;
+}
+
+inline void Model::setSubsetRelativeRate(double rate) {
+    if (!(rate > 0.0)) {
+        throw XStrom(fmt::format(FMT_STRING("Subset relative rate must be positive, not {:g}"), rate));
+    }
+    if (rate != _subset_relative_rate) {
+        _subset_relative_rate = rate;
+        ++_version;
+    }
+}
+
+// Mean (or, with median, median) rates of ncategories gamma categories
+inline void Model::setGammaCategories(unsigned ncategories, bool median) {
+    if (ncategories == 0) {
+        throw XStrom("A model needs at least one rate category");
+    }
+    _gamma_ncategories = ncategories;
+    _gamma_median = median;
+    calcCategoryRates();
+}
+
+inline void Model::setGammaShape(double shape) {
+    if (!(shape > 0.0)) {
+        throw XStrom(fmt::format(FMT_STRING("Gamma shape must be positive, not {:g}"), shape));
+    }
+    if (shape != _gamma_shape) {
+        _gamma_shape = shape;
+        calcCategoryRates();
+    }
+}
+
+inline void Model::setProportionInvariable(double pinvar) {
+    if (!(pinvar >= 0.0 && pinvar < 1.0)) {
+        throw XStrom(fmt::format(FMT_STRING("Proportion of invariable sites must be in [0, 1), not {:g}"), pinvar));
+    }
+    if (pinvar != _pinvar) {
+        _pinvar = pinvar;
+        calcCategoryRates();
+    }
+}
+
+inline void Model::calcCategoryRates() {
+    _category_rates = discreteGammaRates(_gamma_shape, _gamma_ncategories, _gamma_median);
+    for (double &rate : _category_rates) {
+        rate /= 1.0 - _pinvar;
+    }
+    _category_weights.assign(_gamma_ncategories, 1.0 / _gamma_ncategories);
+    ++_version;
+}
+
+/*
+ * With equal rates and frequencies the rate matrix is symmetric, so its
+ * eigenvectors can be chosen orthonormal and the inverse is the transpose.
+ * The Helmert basis is used: a constant vector with eigenvalue 0, and
+ * contrast vectors that all share the eigenvalue -n/(n-1).
+ */
+inline void Model::calcEigenSystem() {
+    unsigned n = _nstates;
+    _eigenvalues.assign(n, -static_cast<double>(n) / (n - 1));
+    _eigenvalues[0] = 0.0;
+
+    _eigenvectors.assign(n * n, 0.0);
+    for (unsigned i = 0; i < n; ++i) {
+        _eigenvectors[i * n] = 1.0 / std::sqrt(static_cast<double>(n));
+    }
+    for (unsigned k = 1; k < n; ++k) {
+        double norm = 1.0 / std::sqrt(static_cast<double>(k) * (k + 1));
+        for (unsigned i = 0; i < k; ++i) {
+            _eigenvectors[i * n + k] = norm;
+        }
+        _eigenvectors[k * n + k] = -static_cast<double>(k) * norm;
+    }
+
+    _inverse_eigenvectors.assign(n * n, 0.0);
+    for (unsigned i = 0; i < n; ++i) {
+        for (unsigned j = 0; j < n; ++j) {
+            _inverse_eigenvectors[j * n + i] = _eigenvectors[i * n + j];
+        }
+    }
+}
+
+}// namespace strom
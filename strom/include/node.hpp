@@ -14,14 +14,14 @@ namespace strom {
 class Tree;
 
 class TreeManip;
-//class Likelihood;
+class Likelihood;
 //class Updater;
 
 class Node {
     friend class Tree;
 
     friend class TreeManip;
-    //friend class Likelihood;
+    friend class Likelihood;
     //friend class Updater;
 
 public:
@@ -51,6 +51,8 @@ public:
 private:
     void clear();
 
+    void markPartialsDirty(bool whole_path = false);
+
     Node *_left_child;
     Node *_right_sib;
     Node *_parent;
@@ -58,6 +60,14 @@ private:
     std::string _name;
     double _edge_length;
     Split _split;
+
+    // Set when the partials of this node, or the transition matrix of the
+    // edge above it, no longer match the tree; cleared by Likelihood
+    bool _partials_dirty;
+    bool _tmatrix_dirty;
+
+    // Position in the tree's preorder vector, kept up to date by TreeManip
+    unsigned _preorder_index;
 };
 
 inline Node::Node() {
@@ -71,10 +81,36 @@ inline void Node::clear() {
     _number = -1;
     _name = "";
     _edge_length = _smallest_edge_length;
+    _partials_dirty = true;
+    _tmatrix_dirty = true;
+    _preorder_index = 0;
 }
 
+/*
+ * Changing an edge length invalidates the transition matrix of the edge and
+ * the partials of every node above it.
+ */
 inline void Node::setEdgeLength(double v) {
     _edge_length = (v < _smallest_edge_length ? _smallest_edge_length : v);
+    _tmatrix_dirty = true;
+    if (_parent) {
+        _parent->markPartialsDirty();
+    }
+}
+
+/*
+ * Flag this node and its ancestors. The walk normally stops at the first node
+ * that is already dirty, because the ancestors of a dirty node are dirty too;
+ * after a subtree has been moved that no longer holds, and whole_path forces
+ * the walk all the way to the root.
+ */
+inline void Node::markPartialsDirty(bool whole_path) {
+    for (Node *nd = this; nd; nd = nd->_parent) {
+        if (nd->_partials_dirty && !whole_path) {
+            break;
+        }
+        nd->_partials_dirty = true;
+    }
 }
 
 }// namespace strom
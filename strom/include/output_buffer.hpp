@@ -0,0 +1,312 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <fmt/format.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Accumulates output in one large in-memory buffer and writes it to a file
+ * in bulk whenever the buffer passes a size threshold. With background
+ * flushing, a full buffer is handed to a writer thread and filling continues
+ * in a second buffer, so formatting and disk writes overlap.
+ */
+class OutputBuffer {
+public:
+    OutputBuffer();
+
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer &) = delete;
+
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    static constexpr std::size_t default_flush_threshold = std::size_t(1) << 22;
+
+    void open(const std::string &filename, bool background_flush = false, std::size_t flush_threshold = default_flush_threshold);
+
+    void close();
+
+    [[nodiscard]] bool isOpen() const;
+
+    template<typename S, typename... Args>
+    void print(const S &format_str, Args &&...args);
+
+    void write(std::string_view s);
+
+    template<typename T>
+    void writeValue(const T &value);
+
+    void writeCsvField(std::string_view s);
+
+    void writeJsonString(std::string_view s);
+
+    void clear();
+
+private:
+    void flushIfFull();
+
+    void flush();
+
+    void writeOut(const std::vector<char> &buffer);
+
+    void writerLoop();
+
+    void waitForWriter();
+
+    std::FILE *_file;
+    std::string _filename;
+    std::size_t _flush_threshold;
+    std::vector<char> _buffer;
+
+    // Background flushing: _pending is written by _writer while _buffer fills
+    bool _background;
+    bool _has_pending;
+    bool _stop;
+    std::vector<char> _pending;
+    std::thread _writer;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::exception_ptr _error;
+
+public:
+    typedef std::shared_ptr<OutputBuffer> SharedPtr;
+};
+
+inline OutputBuffer::OutputBuffer() {
+    _file = nullptr;
+    clear();
+}
+
+inline OutputBuffer::~OutputBuffer() {
+    try {
+        close();
+    } catch (...) {
+        // destructors must not throw; call close() explicitly to see errors
+    }
+}
+
+inline void OutputBuffer::clear() {
+    _filename = "";
+    _flush_threshold = default_flush_threshold;
+    _buffer.clear();
+    _background = false;
+    _has_pending = false;
+    _stop = false;
+    _pending.clear();
+    _error = nullptr;
+}
+
+inline void OutputBuffer::open(const std::string &filename, bool background_flush, std::size_t flush_threshold) {
+    close();
+    _file = std::fopen(filename.c_str(), "wb");
+    if (_file == nullptr) {
+        throw XStrom(fmt::format(FMT_STRING("Could not open {:s} for writing"), filename));
+    }
+    _filename = filename;
+    _flush_threshold = std::max<std::size_t>(flush_threshold, 1);
+    _buffer.reserve(_flush_threshold + _flush_threshold / 4);
+    _background = background_flush;
+    if (_background) {
+        _pending.reserve(_buffer.capacity());
+        _writer = std::thread(&OutputBuffer::writerLoop, this);
+    }
+}
+
+inline bool OutputBuffer::isOpen() const {
+    return _file != nullptr;
+}
+
+/*
+ * Write out everything still buffered, stop the writer thread and close the
+ * file. Rethrows any error met by the writer thread.
+ */
+inline void OutputBuffer::close() {
+    if (_file == nullptr) {
+        return;
+    }
+    std::exception_ptr error;
+    try {
+        flush();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (_background) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _writer.join();
+        if (!error) {
+            error = _error;
+        }
+    }
+    bool closed = (std::fclose(_file) == 0);
+    _file = nullptr;
+    std::string filename = _filename;
+    clear();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (!closed) {
+        throw XStrom(fmt::format(FMT_STRING("Error closing {:s}"), filename));
+    }
+}
+
+template<typename S, typename... Args>
+inline void OutputBuffer::print(const S &format_str, Args &&...args) {
+    fmt::format_to(std::back_inserter(_buffer), format_str, std::forward<Args>(args)...);
+    flushIfFull();
+}
+
+inline void OutputBuffer::write(std::string_view s) {
+    _buffer.insert(_buffer.end(), s.begin(), s.end());
+    flushIfFull();
+}
+
+/*
+ * Append the raw (native byte order) representation of a trivially copyable value.
+ */
+template<typename T>
+inline void OutputBuffer::writeValue(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>, "writeValue needs a trivially copyable type");
+    auto bytes = reinterpret_cast<const char *>(&value);
+    _buffer.insert(_buffer.end(), bytes, bytes + sizeof(T));
+    flushIfFull();
+}
+
+/*
+ * Fields containing separators or quotes are quoted, with embedded quotes doubled (RFC 4180).
+ */
+inline void OutputBuffer::writeCsvField(std::string_view s) {
+    if (s.find_first_of(",\"\r\n") == std::string_view::npos) {
+        write(s);
+        return;
+    }
+    _buffer.push_back('"');
+    for (char c : s) {
+        if (c == '"') {
+            _buffer.push_back('"');
+        }
+        _buffer.push_back(c);
+    }
+    _buffer.push_back('"');
+    flushIfFull();
+}
+
+inline void OutputBuffer::writeJsonString(std::string_view s) {
+    _buffer.push_back('"');
+    for (char c : s) {
+        switch (c) {
+            case '"':
+                write("\\\"");
+                break;
+            case '\\':
+                write("\\\\");
+                break;
+            case '\n':
+                write("\\n");
+                break;
+            case '\r':
+                write("\\r");
+                break;
+            case '\t':
+                write("\\t");
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    fmt::format_to(std::back_inserter(_buffer), FMT_STRING("\\u{:04x}"), static_cast<unsigned>(c));
+                } else {
+                    _buffer.push_back(c);
+                }
+        }
+    }
+    _buffer.push_back('"');
+    flushIfFull();
+}
+
+inline void OutputBuffer::flushIfFull() {
+    if (_buffer.size() >= _flush_threshold) {
+        flush();
+    }
+}
+
+/*
+ * In background mode the full buffer is swapped with the (already written)
+ * pending buffer, so the buffers are reused and never reallocated.
+ */
+inline void OutputBuffer::flush() {
+    if (_file == nullptr) {
+        throw XStrom("OutputBuffer used before being opened");
+    }
+    if (!_background) {
+        writeOut(_buffer);
+        _buffer.clear();
+        return;
+    }
+
+    waitForWriter();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+        std::swap(_buffer, _pending);
+        _has_pending = true;
+    }
+    _cv.notify_all();
+    _buffer.clear();
+}
+
+inline void OutputBuffer::waitForWriter() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this] { return !_has_pending; });
+}
+
+inline void OutputBuffer::writeOut(const std::vector<char> &buffer) {
+    if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), _file) != buffer.size()) {
+        throw XStrom(fmt::format(FMT_STRING("Error writing to {:s}"), _filename));
+    }
+}
+
+inline void OutputBuffer::writerLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cv.wait(lock, [this] { return _has_pending || _stop; });
+        if (!_has_pending) {
+            return;
+        }
+        lock.unlock();
+        try {
+            writeOut(_pending);
+        } catch (...) {
+            lock.lock();
+            _error = std::current_exception();
+            lock.unlock();
+        }
+        _pending.clear();
+        lock.lock();
+        _has_pending = false;
+        _cv.notify_all();
+    }
+}
+
+}// namespace strom
@@ -0,0 +1,320 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace strom {
+
+inline unsigned defaultThreadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return (n > 0 ? n : 1);
+}
+
+/*
+ * Split the index range [0, n) into contiguous chunks and call
+ * fn(begin, end, worker) for each chunk on its own thread. The first
+ * exception thrown by any worker is rethrown once all workers have joined.
+ */
+template<typename Function>
+inline void parallelFor(unsigned n, unsigned nthreads, Function fn) {
+    nthreads = std::max(1u, std::min(nthreads, n));
+    if (nthreads == 1) {
+        fn(0u, n, 0u);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(nthreads);
+    unsigned chunk = (n + nthreads - 1) / nthreads;
+    for (unsigned w = 0; w < nthreads; ++w) {
+        unsigned begin = std::min(n, w * chunk);
+        unsigned end = std::min(n, begin + chunk);
+        workers.emplace_back([&fn, &errors, begin, end, w] {
+            try {
+                fn(begin, end, w);
+            } catch (...) {
+                errors[w] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto &t : workers) {
+        t.join();
+    }
+    for (auto &e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+/*
+ * Assign jobs of the given costs to at most nworkers workers, each job in
+ * decreasing order of cost going to the least loaded worker so far. Returns
+ * the job indices of each worker, in increasing order.
+ */
+inline std::vector<std::vector<unsigned>> balanceByCost(const std::vector<double> &costs, unsigned nworkers) {
+    auto njobs = static_cast<unsigned>(costs.size());
+    nworkers = std::max(1u, std::min(nworkers, njobs));
+    std::vector<unsigned> order(njobs);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&costs](unsigned a, unsigned b) { return costs[a] > costs[b]; });
+
+    std::vector<std::vector<unsigned>> jobs(nworkers);
+    std::vector<double> loads(nworkers, 0.0);
+    for (unsigned j : order) {
+        auto w = static_cast<unsigned>(std::min_element(loads.begin(), loads.end()) - loads.begin());
+        jobs[w].push_back(j);
+        loads[w] += costs[j];
+    }
+    for (auto &worker_jobs : jobs) {
+        std::sort(worker_jobs.begin(), worker_jobs.end());
+    }
+    return jobs;
+}
+
+/*
+ * A fixed set of workers that run one job after another together. run(fn)
+ * calls fn(worker) once for every worker, worker 0 on the calling thread,
+ * and returns once all have finished, rethrowing the first exception any of
+ * them threw. The other workers are threads that sleep on a condition
+ * variable between jobs, so frequent small jobs do not pay for starting
+ * threads.
+ */
+class WorkerPool {
+public:
+    WorkerPool();
+
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void start(unsigned nworkers);
+
+    void stop();
+
+    [[nodiscard]] unsigned size() const { return _nworkers; }
+
+    template<typename Function>
+    void run(Function fn);
+
+private:
+    void workerLoop(unsigned worker);
+
+    unsigned _nworkers;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _job_ready;
+    std::condition_variable _job_done;
+
+    // The current job, type-erased without allocating
+    const void *_job;
+    void (*_call)(const void *, unsigned);
+    unsigned long _generation;
+    unsigned _nrunning;
+    bool _stopping;
+    std::vector<std::exception_ptr> _errors;
+
+public:
+    typedef std::shared_ptr<WorkerPool> SharedPtr;
+};
+
+inline WorkerPool::WorkerPool() {
+    _nworkers = 1;
+    _job = nullptr;
+    _call = nullptr;
+    _generation = 0;
+    _nrunning = 0;
+    _stopping = false;
+}
+
+inline WorkerPool::~WorkerPool() {
+    stop();
+}
+
+inline void WorkerPool::start(unsigned nworkers) {
+    stop();
+    _nworkers = std::max(1u, nworkers);
+    _errors.assign(_nworkers, nullptr);
+    for (unsigned w = 1; w < _nworkers; ++w) {
+        _threads.emplace_back(&WorkerPool::workerLoop, this, w);
+    }
+}
+
+inline void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _job_ready.notify_all();
+    for (auto &t : _threads) {
+        t.join();
+    }
+    _threads.clear();
+    _nworkers = 1;
+    _stopping = false;
+    // new workers count jobs from zero, so must not see an old job as pending
+    _generation = 0;
+    _job = nullptr;
+    _call = nullptr;
+}
+
+template<typename Function>
+inline void WorkerPool::run(Function fn) {
+    if (_nworkers == 1) {
+        fn(0u);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job = &fn;
+        _call = [](const void *job, unsigned worker) { (*static_cast<const Function *>(job))(worker); };
+        std::fill(_errors.begin(), _errors.end(), nullptr);
+        _nrunning = _nworkers - 1;
+        ++_generation;
+    }
+    _job_ready.notify_all();
+    try {
+        fn(0u);
+    } catch (...) {
+        _errors[0] = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _job_done.wait(lock, [this] { return _nrunning == 0; });
+    _job = nullptr;
+    for (auto &e : _errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+inline void WorkerPool::workerLoop(unsigned worker) {
+    unsigned long done = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _job_ready.wait(lock, [&] { return _stopping || _generation != done; });
+        if (_stopping) {
+            return;
+        }
+        done = _generation;
+        const void *job = _job;
+        auto call = _call;
+        lock.unlock();
+        try {
+            call(job, worker);
+        } catch (...) {
+            _errors[worker] = std::current_exception();
+        }
+        lock.lock();
+        if (--_nrunning == 0) {
+            _job_done.notify_one();
+        }
+    }
+}
+
+/*
+ * A bounded queue of capacity slots that producers may fill out of order
+ * but that is consumed in index order 0, 1, 2, ... reserve(i) waits until
+ * the slot for item i is free, i.e. until fewer than capacity items lie
+ * between the consumer and i, and push(i) hands the filled slot over;
+ * front() waits for the next item in order and pop() frees its slot. close()
+ * wakes every waiter, after which reserve() and front() return nullptr, so
+ * that either side can stop the other when it fails.
+ */
+template<typename T>
+class OrderedQueue {
+public:
+    explicit OrderedQueue(unsigned capacity);
+
+    OrderedQueue(const OrderedQueue &) = delete;
+
+    OrderedQueue &operator=(const OrderedQueue &) = delete;
+
+    [[nodiscard]] unsigned capacity() const { return static_cast<unsigned>(_slots.size()); }
+
+    T *reserve(unsigned long index);
+
+    void push(unsigned long index);
+
+    T *front();
+
+    void pop();
+
+    void close();
+
+private:
+    std::vector<T> _slots;
+    std::vector<char> _filled;
+    unsigned long _next;// index of the next item to consume
+    bool _closed;
+    std::mutex _mutex;
+    std::condition_variable _slot_freed;
+    std::condition_variable _item_pushed;
+
+public:
+    typedef std::shared_ptr<OrderedQueue> SharedPtr;
+};
+
+template<typename T>
+inline OrderedQueue<T>::OrderedQueue(unsigned capacity)
+    : _slots(std::max(1u, capacity)), _filled(_slots.size(), 0), _next(0), _closed(false) {
+}
+
+template<typename T>
+inline T *OrderedQueue<T>::reserve(unsigned long index) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slot_freed.wait(lock, [&] { return _closed || index < _next + _slots.size(); });
+    return (_closed ? nullptr : &_slots[index % _slots.size()]);
+}
+
+template<typename T>
+inline void OrderedQueue<T>::push(unsigned long index) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _filled[index % _slots.size()] = 1;
+    }
+    _item_pushed.notify_one();
+}
+
+template<typename T>
+inline T *OrderedQueue<T>::front() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _item_pushed.wait(lock, [&] { return _closed || _filled[_next % _slots.size()]; });
+    return (_closed ? nullptr : &_slots[_next % _slots.size()]);
+}
+
+template<typename T>
+inline void OrderedQueue<T>::pop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _filled[_next % _slots.size()] = 0;
+        ++_next;
+    }
+    _slot_freed.notify_all();
+}
+
+template<typename T>
+inline void OrderedQueue<T>::close() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+    }
+    _slot_freed.notify_all();
+    _item_pushed.notify_all();
+}
+
+}// namespace strom
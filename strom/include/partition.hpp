@@ -0,0 +1,213 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fmt/format.h>
+#include <fstream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Division of the sites of an alignment into named subsets (e.g. genes or
+ * codon positions). Subsets are defined by NEXUS charset syntax: a list of
+ * 1-based sites and ranges, where a range may have a stride ("1-900\3") and
+ * '.' stands for the last site. Sites not covered by any definition form an
+ * extra subset called "default".
+ */
+class Partition {
+public:
+    Partition();
+
+    void addSubset(const std::string &name, const std::string &sites);
+
+    void readSubsets(const std::string &filename);
+
+    void finalize(unsigned nsites);
+
+    [[nodiscard]] unsigned getNumSubsets() const { return static_cast<unsigned>(_names.size()); }
+
+    [[nodiscard]] const std::vector<std::string> &getSubsetNames() const { return _names; }
+
+    [[nodiscard]] const std::vector<unsigned> &getSiteSubsets() const { return _site_subsets; }
+
+    void clear();
+
+private:
+    struct Range {
+        unsigned first;// 1-based; 0 stands for the last site
+        unsigned last;
+        unsigned step;
+    };
+
+    static std::vector<Range> parseRanges(const std::string &name, const std::string &sites);
+
+    static unsigned parseSite(const std::string &name, const std::string &site);
+
+    std::vector<std::string> _names;
+    std::vector<std::vector<Range>> _ranges;
+    std::vector<unsigned> _site_subsets;
+
+public:
+    typedef std::shared_ptr<Partition> SharedPtr;
+};
+
+inline Partition::Partition() {
+    clear();
+}
+
+inline void Partition::clear() {
+    _names.clear();
+    _ranges.clear();
+    _site_subsets.clear();
+}
+
+inline void Partition::addSubset(const std::string &name, const std::string &sites) {
+    if (std::find(_names.begin(), _names.end(), name) != _names.end()) {
+        throw XStrom(fmt::format(FMT_STRING("Subset {:s} is defined twice"), name));
+    }
+    _ranges.push_back(parseRanges(name, sites));
+    _names.push_back(name);
+}
+
+inline unsigned Partition::parseSite(const std::string &name, const std::string &site) {
+    if (site == ".") {
+        return 0;
+    }
+    if (site.empty() || !std::all_of(site.begin(), site.end(), [](unsigned char c) { return std::isdigit(c); }) || std::stoul(site) == 0) {
+        throw XStrom(fmt::format(FMT_STRING("Subset {:s}: {:s} is not a site number (sites start at 1)"), name, site));
+    }
+    return static_cast<unsigned>(std::stoul(site));
+}
+
+// Whitespace-separated items of the form "a", "a-b" or "a-b\step"
+inline std::vector<Partition::Range> Partition::parseRanges(const std::string &name, const std::string &sites) {
+    static const std::regex item_pattern(R"(^([0-9]+|\.)(?:\s*-\s*([0-9]+|\.)(?:\s*\\\s*([0-9]+))?)?)");
+    std::vector<Range> ranges;
+    std::string rest = sites;
+    std::smatch match;
+    while (true) {
+        rest.erase(0, rest.find_first_not_of(" \t\r\n"));
+        if (rest.empty()) {
+            break;
+        }
+        if (!std::regex_search(rest, match, item_pattern)) {
+            throw XStrom(fmt::format(FMT_STRING("Subset {:s}: cannot read sites from \"{:s}\""), name, rest));
+        }
+        Range range{};
+        range.first = parseSite(name, match[1]);
+        range.last = (match[2].matched ? parseSite(name, match[2]) : range.first);
+        range.step = (match[3].matched ? static_cast<unsigned>(std::stoul(match[3])) : 1);
+        if (range.step == 0 || (range.first == 0 && range.last != 0) || (range.last != 0 && range.last < range.first)) {
+            throw XStrom(fmt::format(FMT_STRING("Subset {:s}: invalid range {:s}"), name, match.str(0)));
+        }
+        ranges.push_back(range);
+        rest.erase(0, match.length(0));
+    }
+    if (ranges.empty()) {
+        throw XStrom(fmt::format(FMT_STRING("Subset {:s} has no sites"), name));
+    }
+    return ranges;
+}
+
+/*
+ * Subsets come from the charset statements of a NEXUS file (e.g. the
+ * alignment itself), or from any other file with one "name = sites"
+ * definition per line, optionally preceded by "charset" and followed by ';'.
+ * NEXUS comments are ignored.
+ */
+inline void Partition::readSubsets(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw XStrom(fmt::format(FMT_STRING("Could not open partition file {:s}"), filename));
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = std::regex_replace(buffer.str(), std::regex(R"(\[[^\]]*\])"), "");
+
+    static const std::regex nexus_header(R"(^\s*#nexus)", std::regex::icase);
+    static const std::regex definition(R"(^\s*(?:charset\s+)?([^\s=]+)\s*=\s*([^;]*?)\s*;?\s*$)", std::regex::icase);
+    static const std::regex charset(R"(^\s*charset\s)", std::regex::icase);
+    bool nexus = std::regex_search(text, nexus_header);
+
+    std::vector<std::string> statements;
+    std::istringstream stream(text);
+    std::string statement;
+    while (std::getline(stream, statement, nexus ? ';' : '\n')) {
+        statements.push_back(statement);
+    }
+
+    unsigned nsubsets = 0;
+    std::smatch match;
+    for (auto &s : statements) {
+        if (nexus && !std::regex_search(s, charset)) {
+            continue;
+        }
+        if (s.find_first_not_of(" \t\r\n") == std::string::npos) {
+            continue;
+        }
+        if (!std::regex_match(s, match, definition)) {
+            throw XStrom(fmt::format(FMT_STRING("Cannot read subset definition \"{:s}\" in {:s}"), s, filename));
+        }
+        std::string name = match[1];
+        if (name.size() > 1 && name.front() == '\'' && name.back() == '\'') {
+            name = name.substr(1, name.size() - 2);
+        }
+        addSubset(name, match[2]);
+        ++nsubsets;
+    }
+    if (nsubsets == 0) {
+        throw XStrom(fmt::format(FMT_STRING("No subset definitions found in {:s}"), filename));
+    }
+}
+
+/*
+ * Assign each of the nsites sites to its subset. Subsets must not overlap,
+ * and any sites left over go into a "default" subset.
+ */
+inline void Partition::finalize(unsigned nsites) {
+    if (!_ranges.empty() && _ranges.back().empty()) {
+        // default subset added by an earlier call
+        _names.pop_back();
+        _ranges.pop_back();
+    }
+    const unsigned unassigned = static_cast<unsigned>(-1);
+    _site_subsets.assign(nsites, unassigned);
+    for (unsigned k = 0; k < getNumSubsets(); ++k) {
+        for (auto &range : _ranges[k]) {
+            unsigned first = (range.first == 0 ? nsites : range.first);
+            unsigned last = (range.last == 0 ? nsites : range.last);
+            if (last > nsites) {
+                throw XStrom(fmt::format(FMT_STRING("Subset {:s} refers to site {:d}, but the alignment has {:d} sites"), _names[k], last, nsites));
+            }
+            for (unsigned site = first; site <= last; site += range.step) {
+                unsigned &subset = _site_subsets[site - 1];
+                if (subset != unassigned && subset != k) {
+                    throw XStrom(fmt::format(FMT_STRING("Site {:d} is in both subset {:s} and subset {:s}"), site, _names[subset], _names[k]));
+                }
+                subset = k;
+            }
+        }
+    }
+
+    if (std::find(_site_subsets.begin(), _site_subsets.end(), unassigned) != _site_subsets.end()) {
+        if (std::find(_names.begin(), _names.end(), "default") != _names.end()) {
+            throw XStrom("Some sites are in no subset, but the name \"default\" is already taken");
+        }
+        std::replace(_site_subsets.begin(), _site_subsets.end(), unassigned, getNumSubsets());
+        _names.emplace_back("default");
+        _ranges.emplace_back();
+    }
+}
+
+}// namespace strom
@@ -0,0 +1,203 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "tree.hpp"
+#include "xstrom.hpp"
+#include <cassert>
+#include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Leaf-to-leaf distance matrix stored as a flat, cache-aligned, row-major
+ * array indexed by leaf number. writeBinary() dumps the raw values with no
+ * header, so the file can be mapped directly as T[ntaxa][ntaxa].
+ */
+template<typename T>
+class PatristicMatrix {
+public:
+    PatristicMatrix();
+
+    explicit PatristicMatrix(unsigned ntaxa);
+
+    void resize(unsigned ntaxa);
+
+    void clear();
+
+    [[nodiscard]] unsigned getNumTaxa() const { return _ntaxa; }
+
+    [[nodiscard]] T get(unsigned i, unsigned j) const { return _values[i * _ntaxa + j]; }
+
+    [[nodiscard]] const T *data() const { return _values.data(); }
+
+    T *data() { return _values.data(); }
+
+    void add(const PatristicMatrix<T> &other);
+
+    void scale(T scaler);
+
+    void writeBinary(const std::string &filename) const;
+
+private:
+    unsigned _ntaxa;
+    AlignedVector<T> _values;
+
+public:
+    typedef std::shared_ptr<PatristicMatrix<T>> SharedPtr;
+};
+
+/*
+ * Computes all leaf-to-leaf path lengths of a tree in O(n^2) time.
+ *
+ * Nodes are visited in preorder. Each node's row (distances to every node
+ * visited before it) is derived from its parent's row plus its own edge length,
+ * which is a contiguous vector update. Rows are packed into a lower-triangular
+ * workspace that is reused between trees.
+ */
+template<typename T>
+class PatristicCalculator {
+public:
+    PatristicCalculator() = default;
+
+    void accumulate(const Tree &tree, PatristicMatrix<T> &matrix);
+
+private:
+    AlignedVector<T> _rows;
+    AlignedVector<T> _root_distance;
+    std::vector<unsigned> _position;
+    std::vector<unsigned> _number;
+    Node::PtrVector _order;
+
+public:
+    typedef std::shared_ptr<PatristicCalculator<T>> SharedPtr;
+};
+
+template<typename T>
+inline PatristicMatrix<T>::PatristicMatrix() {
+    clear();
+}
+
+template<typename T>
+inline PatristicMatrix<T>::PatristicMatrix(unsigned ntaxa) {
+    resize(ntaxa);
+}
+
+template<typename T>
+inline void PatristicMatrix<T>::clear() {
+    _ntaxa = 0;
+    _values.clear();
+}
+
+template<typename T>
+inline void PatristicMatrix<T>::resize(unsigned ntaxa) {
+    _ntaxa = ntaxa;
+    _values.assign(static_cast<size_t>(ntaxa) * ntaxa, T(0));
+}
+
+template<typename T>
+inline void PatristicMatrix<T>::add(const PatristicMatrix<T> &other) {
+    assert(_ntaxa == other._ntaxa);
+    T *__restrict dest = _values.data();
+    const T *__restrict src = other._values.data();
+    size_t n = _values.size();
+    for (size_t i = 0; i < n; ++i) {
+        dest[i] += src[i];
+    }
+}
+
+template<typename T>
+inline void PatristicMatrix<T>::scale(T scaler) {
+    for (auto &v : _values) {
+        v *= scaler;
+    }
+}
+
+template<typename T>
+inline void PatristicMatrix<T>::writeBinary(const std::string &filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        throw XStrom(fmt::format(FMT_STRING("Could not open {:s} for writing"), filename));
+    }
+    out.write(reinterpret_cast<const char *>(_values.data()), static_cast<std::streamsize>(_values.size() * sizeof(T)));
+    if (!out) {
+        throw XStrom(fmt::format(FMT_STRING("Error writing patristic distances to {:s}"), filename));
+    }
+}
+
+/*
+ * Add the leaf-to-leaf distances of tree to matrix, which must already be
+ * sized for the tree's leaves.
+ */
+template<typename T>
+inline void PatristicCalculator<T>::accumulate(const Tree &tree, PatristicMatrix<T> &matrix) {
+    if (matrix.getNumTaxa() != tree._nleaves) {
+        throw XStrom(fmt::format(FMT_STRING("Tree has {:d} leaves but distance matrix is sized for {:d}"), tree._nleaves, matrix.getNumTaxa()));
+    }
+
+    // Position 0 is the root, followed by the preorder sequence
+    _order.clear();
+    _order.push_back(tree._root);
+    _order.insert(_order.end(), tree._preorder.begin(), tree._preorder.end());
+    auto nnodes = static_cast<unsigned>(_order.size());
+
+    _position.assign(tree._node_index.size(), 0);
+    _number.resize(nnodes);
+    _root_distance.resize(nnodes);
+    _rows.resize(static_cast<size_t>(nnodes) * (nnodes - 1) / 2);
+    _root_distance[0] = T(0);
+    for (unsigned v = 0; v < nnodes; ++v) {
+        _number[v] = static_cast<unsigned>(_order[v]->getNumber());
+        _position[_number[v]] = v;
+    }
+
+    // Row v holds the distances from node v to nodes 0..v-1 and starts at v*(v-1)/2
+    for (unsigned v = 1; v < nnodes; ++v) {
+        Node *nd = _order[v];
+        unsigned p = _position[nd->getParent()->getNumber()];
+        auto len = static_cast<T>(nd->getEdgeLength());
+        _root_distance[v] = _root_distance[p] + len;
+
+        T *__restrict row = &_rows[static_cast<size_t>(v) * (v - 1) / 2];
+        const T *__restrict parent_row = &_rows[static_cast<size_t>(p) * (p - 1) / 2];
+        const T *__restrict root_distance = _root_distance.data();
+
+        // Nodes visited before the parent: go through the parent
+        for (unsigned u = 0; u < p; ++u) {
+            row[u] = parent_row[u] + len;
+        }
+        row[p] = len;
+
+        // Nodes between the parent and v are the parent's descendants
+        T offset = len - root_distance[p];
+        for (unsigned u = p + 1; u < v; ++u) {
+            row[u] = root_distance[u] + offset;
+        }
+    }
+
+    // Scatter the leaf-to-leaf entries into the output matrix
+    unsigned ntaxa = matrix.getNumTaxa();
+    T *out = matrix.data();
+    for (unsigned v = 1; v < nnodes; ++v) {
+        unsigned a = _number[v];
+        if (a >= ntaxa) {
+            continue;
+        }
+        const T *row = &_rows[static_cast<size_t>(v) * (v - 1) / 2];
+        for (unsigned u = 0; u < v; ++u) {
+            unsigned b = _number[u];
+            if (b < ntaxa) {
+                out[a * ntaxa + b] += row[u];
+                out[b * ntaxa + a] += row[u];
+            }
+        }
+    }
+}
+
+}// namespace strom
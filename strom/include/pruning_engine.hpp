@@ -0,0 +1,627 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STROM_X86_DISPATCH 1
+#endif
+
+namespace strom {
+
+namespace pruning_kernels {
+
+// W values of type T in one vector register
+template<typename T, unsigned W>
+struct Vector {
+    typedef T type __attribute__((vector_size(W * sizeof(T))));
+};
+
+/*
+ * Width of the vectors a kernel uses for NSTATES states with registers of
+ * the given size: a full register, but no more than the NSTATES values of a
+ * row of partials.
+ */
+template<typename T, unsigned NSTATES>
+constexpr unsigned vectorWidth(unsigned register_bytes) {
+    unsigned width = register_bytes / static_cast<unsigned>(sizeof(T));
+    return (width < NSTATES ? width : NSTATES);
+}
+
+/*
+ * One partials operation: the destination and two children, each child with
+ * the strides between its patterns and between its rate categories (zero for
+ * tips, which have no categories), and the transposed transition matrices
+ * [category][to][from] of the children's edges.
+ */
+template<typename T>
+struct PartialsTask {
+    T *destination;
+    const T *child[2];
+    unsigned pattern_stride[2];
+    unsigned category_stride[2];
+    const T *matrices[2];
+    unsigned npatterns;
+    unsigned ncategories;
+};
+
+/*
+ * Destination partials of one pattern and category, for a state count fixed
+ * at compile time (a multiple of four) and vectors of W values. Each
+ * destination row is accumulated one column of the transposed matrices at a
+ * time, in NSTATES/W vector registers per child, plus 4-wide ones for any
+ * states left over (20 states in vectors of 8 or 16). Vectors are moved with
+ * memcpy, which compiles to plain vector loads and stores.
+ */
+template<typename T, unsigned NSTATES, unsigned W>
+[[gnu::always_inline]] inline void partialsRow(const T *left, const T *right, const T *left_matrix, const T *right_matrix, T *out) {
+    typedef typename Vector<T, W>::type vec;
+    typedef typename Vector<T, 4>::type vec4;
+    constexpr unsigned nvec = NSTATES / W;
+    constexpr unsigned first_tail = nvec * W;
+    constexpr unsigned ntail = (NSTATES - first_tail) / 4;
+    vec a[nvec] = {};
+    vec b[nvec] = {};
+    vec4 a_tail[ntail + 1] = {};
+    vec4 b_tail[ntail + 1] = {};
+    for (unsigned j = 0; j < NSTATES; ++j) {
+        T l = left[j];
+        T r = right[j];
+        for (unsigned v = 0; v < nvec; ++v) {
+            vec x, y;
+            std::memcpy(&x, left_matrix + j * NSTATES + W * v, sizeof(vec));
+            std::memcpy(&y, right_matrix + j * NSTATES + W * v, sizeof(vec));
+            a[v] += x * l;
+            b[v] += y * r;
+        }
+        for (unsigned v = 0; v < ntail; ++v) {
+            vec4 x, y;
+            std::memcpy(&x, left_matrix + j * NSTATES + first_tail + 4 * v, sizeof(vec4));
+            std::memcpy(&y, right_matrix + j * NSTATES + first_tail + 4 * v, sizeof(vec4));
+            a_tail[v] += x * l;
+            b_tail[v] += y * r;
+        }
+    }
+    for (unsigned v = 0; v < nvec; ++v) {
+        vec product = a[v] * b[v];
+        std::memcpy(out + W * v, &product, sizeof(vec));
+    }
+    for (unsigned v = 0; v < ntail; ++v) {
+        vec4 product = a_tail[v] * b_tail[v];
+        std::memcpy(out + first_tail + 4 * v, &product, sizeof(vec4));
+    }
+}
+
+template<typename T, unsigned NSTATES, unsigned W>
+[[gnu::always_inline]] inline void partialsBody(const PartialsTask<T> &t) {
+    static_assert(NSTATES % 4 == 0 && W % 4 == 0 && W <= NSTATES, "specialised kernels need a multiple of four states, in vectors of four or more");
+    T *out = t.destination;
+    for (unsigned p = 0; p < t.npatterns; ++p) {
+        for (unsigned c = 0; c < t.ncategories; ++c, out += NSTATES) {
+            const T *left = t.child[0] + p * t.pattern_stride[0] + c * t.category_stride[0];
+            const T *right = t.child[1] + p * t.pattern_stride[1] + c * t.category_stride[1];
+            partialsRow<T, NSTATES, W>(left, right, t.matrices[0] + c * NSTATES * NSTATES, t.matrices[1] + c * NSTATES * NSTATES, out);
+        }
+    }
+}
+
+// Vectors of four, which the compiler splits into SSE registers where it must
+template<typename T, unsigned NSTATES>
+void partials(const PartialsTask<T> &t) {
+    partialsBody<T, NSTATES, 4>(t);
+}
+
+#ifdef STROM_X86_DISPATCH
+// 256-bit registers: 4 doubles or 8 floats
+template<typename T, unsigned NSTATES>
+__attribute__((target("avx2,fma"))) void partialsAVX2(const PartialsTask<T> &t) {
+    partialsBody<T, NSTATES, vectorWidth<T, NSTATES>(32)>(t);
+}
+
+// 512-bit registers: 8 doubles or 16 floats
+template<typename T, unsigned NSTATES>
+__attribute__((target("avx512f,fma"))) void partialsAVX512(const PartialsTask<T> &t) {
+    partialsBody<T, NSTATES, vectorWidth<T, NSTATES>(64)>(t);
+}
+#endif
+
+// Any other number of states, with the state count known only at run time
+template<typename T>
+inline void partialsGeneric(const PartialsTask<T> &t, unsigned nstates) {
+    std::vector<T> right_sums(nstates);
+    T *out = t.destination;
+    for (unsigned p = 0; p < t.npatterns; ++p) {
+        for (unsigned c = 0; c < t.ncategories; ++c, out += nstates) {
+            const T *left = t.child[0] + p * t.pattern_stride[0] + c * t.category_stride[0];
+            const T *right = t.child[1] + p * t.pattern_stride[1] + c * t.category_stride[1];
+            const T *left_matrix = t.matrices[0] + c * nstates * nstates;
+            const T *right_matrix = t.matrices[1] + c * nstates * nstates;
+            std::fill(out, out + nstates, T(0));
+            std::fill(right_sums.begin(), right_sums.end(), T(0));
+            for (unsigned j = 0; j < nstates; ++j) {
+                for (unsigned s = 0; s < nstates; ++s) {
+                    out[s] += left_matrix[j * nstates + s] * left[j];
+                    right_sums[s] += right_matrix[j * nstates + s] * right[j];
+                }
+            }
+            for (unsigned s = 0; s < nstates; ++s) {
+                out[s] *= right_sums[s];
+            }
+        }
+    }
+}
+
+}// namespace pruning_kernels
+
+/*
+ * One partials update for PruningEngine::updatePartials: the destination
+ * buffer is computed from two children and the transition matrices of their
+ * edges, and rescaled into destination_scaler unless that is none.
+ */
+struct PruningOperation {
+    static constexpr int none = -1;
+
+    int destination_partials;
+    int destination_scaler;
+    int child1_partials;
+    int child1_matrix;
+    int child2_partials;
+    int child2_matrix;
+};
+
+/*
+ * A pruning-algorithm likelihood calculator that needs no external library.
+ * It mirrors the BEAGLE calls Likelihood makes (buffers, operations and
+ * scalers are addressed by the same indices), so the two are
+ * interchangeable. Partials of type T (float or double) are laid out
+ * [pattern][category][state] in cache-line aligned buffers; tip buffers have
+ * no category dimension. The partials kernel is specialised for 4 and 20
+ * states and chosen at run time for the widest vector instructions the CPU
+ * supports (AVX-512 or AVX2, both with FMA), using vectors as wide as its
+ * registers but no wider than a row of partials: 4-state rows fit in four
+ * values whatever the instruction set. Log scale factors and log-likelihoods
+ * are always doubles.
+ *
+ * A pattern is rescaled only when its largest partial at a node falls below
+ * the scaling threshold, the fourth root of the smallest normal T: partials
+ * at or above it can be multiplied by a sibling's and by transition
+ * probabilities several times before they would underflow.
+ */
+template<typename T>
+class PruningEngine {
+public:
+    PruningEngine();
+
+    void createInstance(unsigned ntips, unsigned nbuffers, unsigned nstates, unsigned npatterns, unsigned nmatrices, unsigned ncategories, unsigned nscalers);
+
+    void setTipPartials(unsigned tip, const double *partials);
+
+    void setPatternWeights(const double *weights);
+
+    void setStateFrequencies(const double *freqs);
+
+    void setEigenDecomposition(const double *eigenvectors, const double *inverse_eigenvectors, const double *eigenvalues);
+
+    void setCategoryRates(const double *rates);
+
+    void setCategoryWeights(const double *weights);
+
+    void updateTransitionMatrices(const int *indices, const double *edge_lengths, int count);
+
+    void updatePartials(const PruningOperation *operations, int count);
+
+    void resetScaleFactors(int cumulative);
+
+    void accumulateScaleFactors(const int *scalers, int count, int cumulative);
+
+    [[nodiscard]] double calcRootLogLikelihood(int buffer, int cumulative);
+
+    [[nodiscard]] double calcEdgeLogLikelihood(int parent, int child, int matrix, int cumulative);
+
+    void getSiteLogLikelihoods(double *log_likelihoods) const;
+
+    [[nodiscard]] std::string getKernelName() const { return _kernel_name; }
+
+    [[nodiscard]] unsigned long getNumRescaledPatterns() const { return _nrescaled; }
+
+    void clear();
+
+private:
+    void selectKernel();
+
+    void checkBuffer(int index, std::size_t count, const char *what) const;
+
+    [[nodiscard]] unsigned patternStride(int buffer) const;
+
+    [[nodiscard]] unsigned categoryStride(int buffer) const;
+
+    void rescale(T *partials, double *log_factors);
+
+    double sumSiteLogLikelihoods(const std::vector<double> &site_likelihoods, int cumulative);
+
+    unsigned _ntips;
+    unsigned _nstates;
+    unsigned _npatterns;
+    unsigned _ncategories;
+
+    std::vector<AlignedVector<T>> _partials;
+    std::vector<AlignedVector<T>> _matrices;// transposed, [category][to][from]
+    std::vector<std::vector<double>> _scalers;
+    std::vector<double> _pattern_weights;
+    std::vector<double> _state_freqs;
+    std::vector<double> _eigenvectors;
+    std::vector<double> _inverse_eigenvectors;
+    std::vector<double> _eigenvalues;
+    std::vector<double> _category_rates;
+    std::vector<double> _category_weights;
+    std::vector<double> _site_log_likelihoods;// from the last root or edge log-likelihood
+
+    T _scaling_threshold;
+    unsigned long _nrescaled;
+
+    void (*_kernel)(const pruning_kernels::PartialsTask<T> &);
+    std::string _kernel_name;
+
+public:
+    typedef std::shared_ptr<PruningEngine<T>> SharedPtr;
+};
+
+template<typename T>
+inline PruningEngine<T>::PruningEngine() {
+    clear();
+}
+
+template<typename T>
+inline void PruningEngine<T>::clear() {
+    _ntips = 0;
+    _nstates = 0;
+    _npatterns = 0;
+    _ncategories = 0;
+    _scaling_threshold = static_cast<T>(std::pow(static_cast<double>(std::numeric_limits<T>::min()), 0.25));
+    _nrescaled = 0;
+    _partials.clear();
+    _matrices.clear();
+    _scalers.clear();
+    _pattern_weights.clear();
+    _state_freqs.clear();
+    _eigenvectors.clear();
+    _inverse_eigenvectors.clear();
+    _eigenvalues.clear();
+    _category_rates.clear();
+    _category_weights.clear();
+    _site_log_likelihoods.clear();
+    _kernel = nullptr;
+    _kernel_name = "";
+}
+
+/*
+ * Buffers below ntips hold tip partials (one value per pattern and state);
+ * the others hold the partials of every rate category.
+ */
+template<typename T>
+inline void PruningEngine<T>::createInstance(unsigned ntips, unsigned nbuffers, unsigned nstates, unsigned npatterns, unsigned nmatrices, unsigned ncategories,
+                                          unsigned nscalers) {
+    clear();
+    if (nbuffers < ntips || nstates < 2 || ncategories == 0) {
+        throw XStrom(fmt::format(FMT_STRING("Invalid pruning engine dimensions ({:d} tips, {:d} buffers, {:d} states, {:d} categories)"), ntips, nbuffers,
+                                 nstates, ncategories));
+    }
+    _ntips = ntips;
+    _nstates = nstates;
+    _npatterns = npatterns;
+    _ncategories = ncategories;
+
+    _partials.resize(nbuffers);
+    for (unsigned b = 0; b < nbuffers; ++b) {
+        _partials[b].assign(static_cast<std::size_t>(npatterns) * (b < ntips ? 1 : ncategories) * nstates, T(0));
+    }
+    _matrices.assign(nmatrices, AlignedVector<T>(static_cast<std::size_t>(ncategories) * nstates * nstates, T(0)));
+    _scalers.assign(nscalers, std::vector<double>(npatterns, 0.0));
+    _pattern_weights.assign(npatterns, 1.0);
+    _state_freqs.assign(nstates, 1.0 / nstates);
+    _category_rates.assign(ncategories, 1.0);
+    _category_weights.assign(ncategories, 1.0 / ncategories);
+    selectKernel();
+}
+
+/*
+ * Every kernel is compiled for each instruction set, and the CPU is asked
+ * once which to use. Other state counts fall back to the generic loop.
+ */
+template<typename T>
+inline void PruningEngine<T>::selectKernel() {
+    using namespace pruning_kernels;
+    std::string isa = "baseline";
+#ifdef STROM_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma")) {
+        isa = "AVX-512";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        isa = "AVX2";
+    }
+#endif
+    if (_nstates == 4 || _nstates == 20) {
+        bool dna = (_nstates == 4);
+#ifdef STROM_X86_DISPATCH
+        if (isa == "AVX-512") {
+            _kernel = (dna ? partialsAVX512<T, 4> : partialsAVX512<T, 20>);
+        } else if (isa == "AVX2") {
+            _kernel = (dna ? partialsAVX2<T, 4> : partialsAVX2<T, 20>);
+        } else {
+            _kernel = (dna ? partials<T, 4> : partials<T, 20>);
+        }
+#else
+        _kernel = (dna ? partials<T, 4> : partials<T, 20>);
+#endif
+        _kernel_name = fmt::format(FMT_STRING("{:s} {:d}-state kernel"), isa, _nstates);
+    } else {
+        _kernel = nullptr;
+        _kernel_name = fmt::format(FMT_STRING("generic {:d}-state kernel"), _nstates);
+    }
+}
+
+template<typename T>
+inline void PruningEngine<T>::checkBuffer(int index, std::size_t count, const char *what) const {
+    if (index < 0 || static_cast<std::size_t>(index) >= count) {
+        throw XStrom(fmt::format(FMT_STRING("Pruning engine {:s} index {:d} out of range"), what, index));
+    }
+}
+
+template<typename T>
+inline unsigned PruningEngine<T>::patternStride(int buffer) const {
+    return (static_cast<unsigned>(buffer) < _ntips ? _nstates : _ncategories * _nstates);
+}
+
+template<typename T>
+inline unsigned PruningEngine<T>::categoryStride(int buffer) const {
+    return (static_cast<unsigned>(buffer) < _ntips ? 0 : _nstates);
+}
+
+template<typename T>
+inline void PruningEngine<T>::setTipPartials(unsigned tip, const double *partials) {
+    checkBuffer(static_cast<int>(tip), _ntips, "tip");
+    std::copy(partials, partials + static_cast<std::size_t>(_npatterns) * _nstates, _partials[tip].begin());
+}
+
+template<typename T>
+inline void PruningEngine<T>::setPatternWeights(const double *weights) {
+    _pattern_weights.assign(weights, weights + _npatterns);
+}
+
+template<typename T>
+inline void PruningEngine<T>::setStateFrequencies(const double *freqs) {
+    _state_freqs.assign(freqs, freqs + _nstates);
+}
+
+// Row-major matrices, as for beagleSetEigenDecomposition
+template<typename T>
+inline void PruningEngine<T>::setEigenDecomposition(const double *eigenvectors, const double *inverse_eigenvectors, const double *eigenvalues) {
+    std::size_t n2 = static_cast<std::size_t>(_nstates) * _nstates;
+    _eigenvectors.assign(eigenvectors, eigenvectors + n2);
+    _inverse_eigenvectors.assign(inverse_eigenvectors, inverse_eigenvectors + n2);
+    _eigenvalues.assign(eigenvalues, eigenvalues + _nstates);
+}
+
+template<typename T>
+inline void PruningEngine<T>::setCategoryRates(const double *rates) {
+    _category_rates.assign(rates, rates + _ncategories);
+}
+
+template<typename T>
+inline void PruningEngine<T>::setCategoryWeights(const double *weights) {
+    _category_weights.assign(weights, weights + _ncategories);
+}
+
+/*
+ * P(t) = V exp(D r t) V^-1 for each category rate r, stored transposed so
+ * that the kernels read the probabilities of reaching every state from one
+ * starting state as a contiguous column. Each row of P is accumulated as a
+ * sum of rows of exp(D r t) V^-1, so the innermost loop runs over contiguous
+ * memory and vectorises.
+ */
+template<typename T>
+inline void PruningEngine<T>::updateTransitionMatrices(const int *indices, const double *edge_lengths, int count) {
+    if (_eigenvalues.empty()) {
+        throw XStrom("Pruning engine needs an eigendecomposition before transition matrices");
+    }
+    unsigned n = _nstates;
+    std::vector<double> scaled(static_cast<std::size_t>(n) * n);
+    std::vector<double> row(n);
+    for (int i = 0; i < count; ++i) {
+        checkBuffer(indices[i], _matrices.size(), "matrix");
+        T *matrix = _matrices[indices[i]].data();
+        for (unsigned c = 0; c < _ncategories; ++c, matrix += n * n) {
+            double t = edge_lengths[i] * _category_rates[c];
+            for (unsigned k = 0; k < n; ++k) {
+                double e = std::exp(_eigenvalues[k] * t);
+                for (unsigned j = 0; j < n; ++j) {
+                    scaled[k * n + j] = e * _inverse_eigenvectors[k * n + j];
+                }
+            }
+            for (unsigned from = 0; from < n; ++from) {
+                std::fill(row.begin(), row.end(), 0.0);
+                for (unsigned k = 0; k < n; ++k) {
+                    double v = _eigenvectors[from * n + k];
+                    const double *s = scaled.data() + k * n;
+                    for (unsigned to = 0; to < n; ++to) {
+                        row[to] += v * s[to];
+                    }
+                }
+                for (unsigned to = 0; to < n; ++to) {
+                    matrix[to * n + from] = static_cast<T>(std::max(row[to], 0.0));
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Operations run in the order given, so children must come before parents.
+ * An operation with a destination scale buffer records a log scale factor
+ * for every pattern: zero, or the log of the largest partial if the pattern
+ * was rescaled.
+ */
+template<typename T>
+inline void PruningEngine<T>::updatePartials(const PruningOperation *operations, int count) {
+    for (int i = 0; i < count; ++i) {
+        const PruningOperation &op = operations[i];
+        checkBuffer(op.destination_partials, _partials.size(), "partials");
+        checkBuffer(op.child1_partials, _partials.size(), "partials");
+        checkBuffer(op.child2_partials, _partials.size(), "partials");
+        checkBuffer(op.child1_matrix, _matrices.size(), "matrix");
+        checkBuffer(op.child2_matrix, _matrices.size(), "matrix");
+        if (static_cast<unsigned>(op.destination_partials) < _ntips) {
+            throw XStrom(fmt::format(FMT_STRING("Pruning engine cannot write partials to tip buffer {:d}"), op.destination_partials));
+        }
+
+        pruning_kernels::PartialsTask<T> task{};
+        task.destination = _partials[op.destination_partials].data();
+        task.child[0] = _partials[op.child1_partials].data();
+        task.child[1] = _partials[op.child2_partials].data();
+        task.pattern_stride[0] = patternStride(op.child1_partials);
+        task.pattern_stride[1] = patternStride(op.child2_partials);
+        task.category_stride[0] = categoryStride(op.child1_partials);
+        task.category_stride[1] = categoryStride(op.child2_partials);
+        task.matrices[0] = _matrices[op.child1_matrix].data();
+        task.matrices[1] = _matrices[op.child2_matrix].data();
+        task.npatterns = _npatterns;
+        task.ncategories = _ncategories;
+        if (_kernel) {
+            _kernel(task);
+        } else {
+            pruning_kernels::partialsGeneric(task, _nstates);
+        }
+
+        if (op.destination_scaler != PruningOperation::none) {
+            checkBuffer(op.destination_scaler, _scalers.size(), "scaler");
+            rescale(task.destination, _scalers[op.destination_scaler].data());
+        }
+    }
+}
+
+template<typename T>
+inline void PruningEngine<T>::rescale(T *partials, double *log_factors) {
+    unsigned block = _ncategories * _nstates;
+    for (unsigned p = 0; p < _npatterns; ++p, partials += block) {
+        T largest = *std::max_element(partials, partials + block);
+        if (largest < _scaling_threshold && largest > T(0)) {
+            T inverse = T(1) / largest;
+            for (unsigned i = 0; i < block; ++i) {
+                partials[i] *= inverse;
+            }
+            log_factors[p] = std::log(static_cast<double>(largest));
+            ++_nrescaled;
+        } else {
+            log_factors[p] = 0.0;
+        }
+    }
+}
+
+template<typename T>
+inline void PruningEngine<T>::resetScaleFactors(int cumulative) {
+    checkBuffer(cumulative, _scalers.size(), "scaler");
+    std::fill(_scalers[cumulative].begin(), _scalers[cumulative].end(), 0.0);
+}
+
+template<typename T>
+inline void PruningEngine<T>::accumulateScaleFactors(const int *scalers, int count, int cumulative) {
+    checkBuffer(cumulative, _scalers.size(), "scaler");
+    std::vector<double> &total = _scalers[cumulative];
+    for (int i = 0; i < count; ++i) {
+        checkBuffer(scalers[i], _scalers.size(), "scaler");
+        const std::vector<double> &factors = _scalers[scalers[i]];
+        for (unsigned p = 0; p < _npatterns; ++p) {
+            total[p] += factors[p];
+        }
+    }
+}
+
+template<typename T>
+inline double PruningEngine<T>::sumSiteLogLikelihoods(const std::vector<double> &site_likelihoods, int cumulative) {
+    const double *factors = nullptr;
+    if (cumulative != PruningOperation::none) {
+        checkBuffer(cumulative, _scalers.size(), "scaler");
+        factors = _scalers[cumulative].data();
+    }
+    _site_log_likelihoods.resize(_npatterns);
+    double log_likelihood = 0.0;
+    for (unsigned p = 0; p < _npatterns; ++p) {
+        _site_log_likelihoods[p] = std::log(site_likelihoods[p]) + (factors ? factors[p] : 0.0);
+        log_likelihood += _pattern_weights[p] * _site_log_likelihoods[p];
+    }
+    return log_likelihood;
+}
+
+// Unweighted log-likelihood of each pattern, as computed by the last root or edge log-likelihood
+template<typename T>
+inline void PruningEngine<T>::getSiteLogLikelihoods(double *log_likelihoods) const {
+    if (_site_log_likelihoods.size() != _npatterns) {
+        throw XStrom("Pruning engine has no site log-likelihoods before a log-likelihood is calculated");
+    }
+    std::copy(_site_log_likelihoods.begin(), _site_log_likelihoods.end(), log_likelihoods);
+}
+
+template<typename T>
+inline double PruningEngine<T>::calcRootLogLikelihood(int buffer, int cumulative) {
+    checkBuffer(buffer, _partials.size(), "partials");
+    const T *partials = _partials[buffer].data();
+    unsigned pattern_stride = patternStride(buffer);
+    unsigned category_stride = categoryStride(buffer);
+    std::vector<double> site_likelihoods(_npatterns, 0.0);
+    for (unsigned p = 0; p < _npatterns; ++p) {
+        for (unsigned c = 0; c < _ncategories; ++c) {
+            const T *x = partials + p * pattern_stride + c * category_stride;
+            double sum = 0.0;
+            for (unsigned s = 0; s < _nstates; ++s) {
+                sum += _state_freqs[s] * x[s];
+            }
+            site_likelihoods[p] += _category_weights[c] * sum;
+        }
+    }
+    return sumSiteLogLikelihoods(site_likelihoods, cumulative);
+}
+
+// The matrix is that of the edge from parent down to child
+template<typename T>
+inline double PruningEngine<T>::calcEdgeLogLikelihood(int parent, int child, int matrix, int cumulative) {
+    checkBuffer(parent, _partials.size(), "partials");
+    checkBuffer(child, _partials.size(), "partials");
+    checkBuffer(matrix, _matrices.size(), "matrix");
+    unsigned n = _nstates;
+    std::vector<double> site_likelihoods(_npatterns, 0.0);
+    std::vector<double> child_sums(n);
+    for (unsigned p = 0; p < _npatterns; ++p) {
+        for (unsigned c = 0; c < _ncategories; ++c) {
+            const T *x = _partials[parent].data() + p * patternStride(parent) + c * categoryStride(parent);
+            const T *y = _partials[child].data() + p * patternStride(child) + c * categoryStride(child);
+            const T *m = _matrices[matrix].data() + c * n * n;
+            std::fill(child_sums.begin(), child_sums.end(), 0.0);
+            for (unsigned j = 0; j < n; ++j) {
+                for (unsigned s = 0; s < n; ++s) {
+                    child_sums[s] += m[j * n + s] * y[j];
+                }
+            }
+            double sum = 0.0;
+            for (unsigned s = 0; s < n; ++s) {
+                sum += _state_freqs[s] * x[s] * child_sums[s];
+            }
+            site_likelihoods[p] += _category_weights[c] * sum;
+        }
+    }
+    return sumSiteLogLikelihoods(site_likelihoods, cumulative);
+}
+
+}// namespace strom
@@ -0,0 +1,182 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "data.hpp"
+#include "output_buffer.hpp"
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fmt/format.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Writes the log-likelihood of every site under each of a sequence of
+ * samples (e.g. the trees of a posterior sample) to a binary file, the
+ * samples x sites matrix needed by PSIS-LOO and WAIC. Samples arrive as one
+ * log-likelihood per pattern and are only expanded to sites, through the
+ * site-to-pattern map of Data, as a block is written, so memory holds one
+ * block of pattern rows however many samples there are. Each block is laid
+ * out in a reused byte buffer and handed to a background-flushing
+ * OutputBuffer in one write, so the caller only waits for the disk if it
+ * produces faster than the disk can take.
+ *
+ * File layout, in native byte order:
+ *   header  char[8] "STROMSLL", uint32 format version (1), uint32 nsites,
+ *           uint32 samples per full block
+ *   blocks  uint32 samples in the block (n), then for each site in turn the
+ *           n doubles of that site's column
+ *   end     uint32 0, uint64 total number of samples
+ * A reader can take all samples of a run of sites with one read per block.
+ */
+class SiteLikelihoodWriter {
+public:
+    SiteLikelihoodWriter();
+
+    ~SiteLikelihoodWriter();
+
+    SiteLikelihoodWriter(const SiteLikelihoodWriter &) = delete;
+
+    SiteLikelihoodWriter &operator=(const SiteLikelihoodWriter &) = delete;
+
+    static constexpr std::uint32_t format_version = 1;
+
+    static constexpr std::size_t default_block_bytes = std::size_t(1) << 24;
+
+    void open(const std::string &filename, Data::SharedPtr data, unsigned block_size = 0);
+
+    void addSample(const std::vector<double> &pattern_log_likelihoods);
+
+    void close();
+
+    [[nodiscard]] bool isOpen() const { return _out.isOpen(); }
+
+    [[nodiscard]] unsigned getBlockSize() const { return _block_size; }
+
+    [[nodiscard]] unsigned long getNumSamples() const { return _nsamples; }
+
+    void clear();
+
+private:
+    void writeBlock();
+
+    OutputBuffer _out;
+    std::vector<unsigned> _site_patterns;
+    unsigned _npatterns;
+    unsigned _block_size;
+    std::vector<double> _block;// one row of _npatterns values per sample
+    std::vector<char> _block_bytes;// the block as written to the file
+    unsigned _nblock_samples;
+    unsigned long _nsamples;
+
+public:
+    typedef std::shared_ptr<SiteLikelihoodWriter> SharedPtr;
+};
+
+inline SiteLikelihoodWriter::SiteLikelihoodWriter() {
+    clear();
+}
+
+inline SiteLikelihoodWriter::~SiteLikelihoodWriter() {
+    try {
+        close();
+    } catch (...) {
+        // destructors must not throw; call close() explicitly to see errors
+    }
+}
+
+inline void SiteLikelihoodWriter::clear() {
+    _site_patterns.clear();
+    _npatterns = 0;
+    _block_size = 0;
+    _block.clear();
+    _block_bytes.clear();
+    _nblock_samples = 0;
+    _nsamples = 0;
+}
+
+/*
+ * A block_size of 0 fits as many samples in a block as default_block_bytes
+ * of site log-likelihoods allows, the size of a block as written.
+ */
+inline void SiteLikelihoodWriter::open(const std::string &filename, Data::SharedPtr data, unsigned block_size) {
+    close();
+    if (!data || data->getNumSites() == 0) {
+        throw XStrom("Site log-likelihoods need data with at least one site");
+    }
+    _site_patterns = data->getSitePatterns();
+    _npatterns = data->getNumPatterns();
+    if (block_size == 0) {
+        std::size_t row_bytes = sizeof(double) * _site_patterns.size();
+        block_size = static_cast<unsigned>(std::clamp<std::size_t>(default_block_bytes / row_bytes, 1, 1u << 16));
+    }
+    _block_size = block_size;
+    _block.resize(static_cast<std::size_t>(_block_size) * _npatterns);
+
+    _out.open(filename, true);
+    _out.write("STROMSLL");
+    _out.writeValue(format_version);
+    _out.writeValue(static_cast<std::uint32_t>(_site_patterns.size()));
+    _out.writeValue(static_cast<std::uint32_t>(_block_size));
+}
+
+inline void SiteLikelihoodWriter::addSample(const std::vector<double> &pattern_log_likelihoods) {
+    if (!isOpen()) {
+        throw XStrom("SiteLikelihoodWriter used before being opened");
+    }
+    if (pattern_log_likelihoods.size() != _npatterns) {
+        throw XStrom(fmt::format(FMT_STRING("Sample has {:d} pattern log-likelihoods, but the data have {:d} patterns"), pattern_log_likelihoods.size(),
+                                 _npatterns));
+    }
+    std::copy(pattern_log_likelihoods.begin(), pattern_log_likelihoods.end(), _block.begin() + static_cast<std::size_t>(_nblock_samples) * _npatterns);
+    ++_nsamples;
+    if (++_nblock_samples == _block_size) {
+        writeBlock();
+    }
+}
+
+// Transpose the block's pattern rows into site columns and write them at once
+inline void SiteLikelihoodWriter::writeBlock() {
+    if (_nblock_samples == 0) {
+        return;
+    }
+    auto nblock_samples = static_cast<std::uint32_t>(_nblock_samples);
+    _block_bytes.resize(sizeof(nblock_samples) + sizeof(double) * _site_patterns.size() * _nblock_samples);
+    char *bytes = _block_bytes.data();
+    std::memcpy(bytes, &nblock_samples, sizeof(nblock_samples));
+    bytes += sizeof(nblock_samples);
+    for (unsigned pattern : _site_patterns) {
+        for (unsigned b = 0; b < _nblock_samples; ++b) {
+            std::memcpy(bytes, &_block[static_cast<std::size_t>(b) * _npatterns + pattern], sizeof(double));
+            bytes += sizeof(double);
+        }
+    }
+    _out.write(std::string_view(_block_bytes.data(), _block_bytes.size()));
+    _nblock_samples = 0;
+}
+
+/*
+ * Write the last, partial block and the end marker, and wait for the writer
+ * thread to finish.
+ */
+inline void SiteLikelihoodWriter::close() {
+    if (!isOpen()) {
+        return;
+    }
+    writeBlock();
+    _out.writeValue(std::uint32_t(0));
+    _out.writeValue(static_cast<std::uint64_t>(_nsamples));
+    _out.close();
+    clear();
+}
+
+}// namespace strom
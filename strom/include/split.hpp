@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include "hash.hpp"
+#include "index_list.hpp"
+#include <bitset>
 #include <cassert>
 #include <climits>
 #include <iostream>
@@ -29,11 +32,19 @@ public:
     typedef unsigned long split_unit_t;
     typedef std::vector<split_unit_t> split_t;
     typedef std::set<Split> treeid_t;
-    typedef std::map<treeid_t, std::vector<unsigned>> treemap_t;
+    typedef std::map<treeid_t, IndexList> treemap_t;
     typedef std::tuple<unsigned, unsigned, unsigned> split_metrics_t;
 
     [[nodiscard]] split_unit_t getBits(unsigned unit_index) const;
 
+    [[nodiscard]] unsigned getNumUnits() const;
+
+    [[nodiscard]] unsigned getNumLeaves() const;
+
+    [[nodiscard]] unsigned countBits() const;
+
+    [[nodiscard]] std::size_t hash() const;
+
     [[nodiscard]] bool getBitAt(unsigned leaf_index) const;
 
     void setBitAt(unsigned leaf_index);
@@ -60,6 +71,13 @@ public:
     typedef std::shared_ptr<Split> SharedPtr;
 };
 
+// Hasher for unordered containers keyed by splits
+struct SplitHash {
+    std::size_t operator()(const Split &split) const {
+        return split.hash();
+    }
+};
+
 inline Split::Split() {
     _mask = 0L;
     _nleaves = 0;
@@ -113,6 +131,27 @@ inline Split::split_unit_t Split::getBits(unsigned int unit_index) const {
     return _bits[unit_index];
 }
 
+inline unsigned Split::getNumUnits() const {
+    return static_cast<unsigned>(_bits.size());
+}
+
+inline unsigned Split::getNumLeaves() const {
+    return _nleaves;
+}
+
+// Number of leaves on the side of the split whose bits are set
+inline unsigned Split::countBits() const {
+    unsigned n = 0;
+    for (split_unit_t unit : _bits) {
+        n += static_cast<unsigned>(std::bitset<CHAR_BIT * sizeof(split_unit_t)>(unit).count());
+    }
+    return n;
+}
+
+inline std::size_t Split::hash() const {
+    return static_cast<std::size_t>(hashBytes(reinterpret_cast<const char *>(_bits.data()), _bits.size() * sizeof(split_unit_t)));
+}
+
 inline bool Split::getBitAt(unsigned int leaf_index) const {
     unsigned unit_index = leaf_index / _bits_per_unit;
     unsigned bit_index = leaf_index - unit_index * _bits_per_unit;
@@ -3,13 +3,26 @@
 //
 
 #pragma once
+#include "asdsf.hpp"
+#include "data.hpp"
+#include "likelihood.hpp"
+#include "output_buffer.hpp"
+#include "parallel.hpp"
+#include "site_likelihood_writer.hpp"
+#include "tree_file_follower.hpp"
 #include "tree_summary.hpp"
 
 #include <CLI11.hpp>
 #include <fmt/core.h>
 
+#include <chrono>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <thread>
 
 inline bool exists(const std::string &name) {
     std::ifstream f(name.c_str());
@@ -28,9 +41,66 @@ public:
     void run();
 
 private:
+    void showASDSF() const;
+
+    void followTreefile();
+
+    void showSummaries() const;
+
+    [[nodiscard]] Model::SharedPtr createModel() const;
+
+    void configureLikelihood(Likelihood &likelihood) const;
+
+    void showLikelihood() const;
+
+    void validatePrecision() const;
+
+    void benchmarkLikelihood() const;
+
+    void benchmarkNewick() const;
+
+    void scoreTrees();
+
     std::string _data_file_name;
+    std::string _data_format;
+    std::string _partition_file_name;
+    std::vector<double> _subset_rates;
+    unsigned _gamma_categories;
+    double _gamma_shape;
+    bool _gamma_median;
+    double _pinvar;
+    bool _calc_likelihood;
+    bool _score_trees;
+    std::string _scores_file_name;
+    std::string _site_file_name;
+    std::string _beagle_implementation;
+    bool _single_precision;
+    bool _validate_precision;
+    bool _benchmark;
+    bool _benchmark_newick;
+    double _precision_tolerance;
     std::string _tree_file_name;
+    std::vector<unsigned> _outgroup;
+    std::string _patristic_file_name;
+    bool _use_parse_cache;
+    bool _compact_summary;
+    bool _show_credible_sets;
+    bool _show_edge_lengths;
+    unsigned _ess_traces;
+    std::vector<std::string> _run_file_names;
+    double _asdsf_min_frequency;
+    double _asdsf_window_fraction;
+    bool _follow;
+    double _follow_interval;
+    unsigned _poll_interval;
+    std::string _topology_table_file_name;
+    std::string _split_table_file_name;
+    std::string _table_format;
+    bool _background_flush;
+    unsigned _top_k;
+    unsigned _nthreads;
 
+    Data::SharedPtr _data;
     TreeSummary::SharedPtr _tree_summary;
 
     static std::string _program_name;
@@ -44,7 +114,44 @@ inline Strom::Strom() {
 
 inline void Strom::clear() {
     _data_file_name = "";
+    _data_format = "nexus";
+    _partition_file_name = "";
+    _subset_rates.clear();
+    _gamma_categories = 1;
+    _gamma_shape = 1.0;
+    _gamma_median = false;
+    _pinvar = 0.0;
+    _calc_likelihood = false;
+    _score_trees = false;
+    _scores_file_name = "";
+    _site_file_name = "";
+    _beagle_implementation = "auto";
+    _single_precision = false;
+    _validate_precision = false;
+    _benchmark = false;
+    _benchmark_newick = false;
+    _precision_tolerance = 1.0e-6;
     _tree_file_name = "";
+    _outgroup.clear();
+    _patristic_file_name = "";
+    _use_parse_cache = false;
+    _compact_summary = false;
+    _show_credible_sets = false;
+    _show_edge_lengths = false;
+    _ess_traces = 0;
+    _run_file_names.clear();
+    _asdsf_min_frequency = 0.1;
+    _asdsf_window_fraction = 1.0;
+    _follow = false;
+    _follow_interval = 60.0;
+    _poll_interval = 1000;
+    _topology_table_file_name = "";
+    _split_table_file_name = "";
+    _table_format = "csv";
+    _background_flush = false;
+    _top_k = 0;
+    _nthreads = defaultThreadCount();
+    _data = nullptr;
     _tree_summary = nullptr;
 }
 
@@ -52,6 +159,47 @@ inline void Strom::processCommandLineOptions(int argc, const char *argv[]) {
     CLI::App app{"strom"};
     app.add_option("datafile", _data_file_name);
     app.add_option("treefile", _tree_file_name);
+    app.add_option("--data-format", _data_format, "Format of the data file")
+        ->check(CLI::IsMember({"nexus", "fasta-dna", "fasta-aa", "phylip-dna", "phylip-aa", "relaxed-phylip-dna", "relaxed-phylip-aa"}));
+    app.add_option("--partition", _partition_file_name, "Divide the sites into subsets defined by charsets in this file (NEXUS or name = sites lines)");
+    app.add_option("--subset-rates", _subset_rates, "Comma-separated relative rates of the subsets, in the order they are defined")
+        ->delimiter(',')
+        ->check(CLI::PositiveNumber);
+    app.add_option("--gamma-categories", _gamma_categories, "Number of discrete gamma rate categories (1 for no rate variation)")->check(CLI::PositiveNumber);
+    app.add_option("--gamma-shape", _gamma_shape, "Shape of the gamma distribution of rates across sites")->check(CLI::PositiveNumber);
+    app.add_flag("--gamma-median", _gamma_median, "Represent each gamma category by its median rate instead of its mean");
+    app.add_option("--pinvar", _pinvar, "Proportion of invariable sites")->check(CLI::Range(0.0, 0.999));
+    app.add_flag("--likelihood", _calc_likelihood, "Compute the log-likelihood of the first tree given the data");
+    app.add_flag("--score-trees", _score_trees, "Compute the log-likelihood of every tree given the data");
+    app.add_option("--scores", _scores_file_name, "Write the log-likelihood of every tree scored by --score-trees to this CSV file");
+    app.add_option("--site-log-likelihoods", _site_file_name, "Write the log-likelihood of every site under every scored tree to this binary file");
+    app.add_option("--beagle-impl", _beagle_implementation, "Likelihood implementation: a BEAGLE one, or native")
+        ->check(CLI::IsMember({"auto", "cpu", "sse", "avx", "threaded", "native"}));
+    app.add_flag("--single-precision", _single_precision, "Compute likelihoods with single-precision partials");
+    app.add_flag("--validate-precision", _validate_precision, "Compare single- and double-precision log-likelihoods of every tree");
+    app.add_flag("--benchmark", _benchmark, "Time the native engine and BEAGLE on the first tree with growing numbers of patterns");
+    app.add_flag("--benchmark-newick", _benchmark_newick, "Time the newick writers on the trees read");
+    app.add_option("--precision-tolerance", _precision_tolerance, "Largest relative log-likelihood difference accepted by --validate-precision")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--outgroup", _outgroup, "Comma-separated taxon numbers used to reroot every tree")->delimiter(',');
+    app.add_option("--patristic", _patristic_file_name, "Write the mean patristic distance matrix to this binary file");
+    app.add_flag("--parse-cache", _use_parse_cache, "Skip parsing newick descriptions that have been seen before");
+    app.add_flag("--compact-summary", _compact_summary, "Report tree counts and first/last occurrence instead of listing every tree");
+    app.add_flag("--credible-sets", _show_credible_sets, "Show the 50%, 95% and 99% credible sets of topologies");
+    app.add_flag("--edge-lengths", _show_edge_lengths, "Show the mean and standard deviation of each edge length per topology");
+    app.add_option("--ess", _ess_traces, "Show the ESS of the presence traces of this many of the most frequent topologies and splits");
+    app.add_option("--runs", _run_file_names, "Comma-separated tree files from independent runs, compared by ASDSF")->delimiter(',');
+    app.add_option("--asdsf-min-freq", _asdsf_min_frequency, "Ignore splits below this frequency in every run when computing ASDSF")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--asdsf-window", _asdsf_window_fraction, "Fraction of the most recent trees of each run used for ASDSF")->check(CLI::Range(0.0, 1.0));
+    app.add_flag("--follow", _follow, "Keep reading trees as they are appended to the tree file, until its TREES block ends");
+    app.add_option("--follow-interval", _follow_interval, "Seconds between summaries in follow mode")->check(CLI::NonNegativeNumber);
+    app.add_option("--poll-interval", _poll_interval, "Milliseconds between checks of the tree file for new trees in follow mode")->check(CLI::PositiveNumber);
+    app.add_option("--topology-table", _topology_table_file_name, "Write topology frequencies to this file");
+    app.add_option("--split-table", _split_table_file_name, "Write split frequencies to this file");
+    app.add_option("--table-format", _table_format, "Format of the topology and split tables")->check(CLI::IsMember({"csv", "json", "binary"}));
+    app.add_flag("--background-flush", _background_flush, "Write tables to disk from a background thread");
+    app.add_option("--top-k", _top_k, "Track only the k most frequent topologies, using bounded memory");
+    app.add_option("--threads", _nthreads, "Number of worker threads")->check(CLI::PositiveNumber);
 
     try {
         app.parse(argc, argv);
@@ -65,15 +213,108 @@ inline void Strom::run() {
     std::cout << "Starting..." << std::endl;
 
     try {
+        // Read the alignment, if one was given
+        if (!_data_file_name.empty()) {
+            static const std::map<std::string, MultiFormatReader::DataFormatType> formats = {
+                    {"nexus", MultiFormatReader::NEXUS_FORMAT},
+                    {"fasta-dna", MultiFormatReader::FASTA_DNA_FORMAT},
+                    {"fasta-aa", MultiFormatReader::FASTA_AA_FORMAT},
+                    {"phylip-dna", MultiFormatReader::PHYLIP_DNA_FORMAT},
+                    {"phylip-aa", MultiFormatReader::PHYLIP_AA_FORMAT},
+                    {"relaxed-phylip-dna", MultiFormatReader::RELAXED_PHYLIP_DNA_FORMAT},
+                    {"relaxed-phylip-aa", MultiFormatReader::RELAXED_PHYLIP_AA_FORMAT}};
+            _data = std::make_shared<Data>();
+            if (!_partition_file_name.empty()) {
+                auto partition = std::make_shared<Partition>();
+                partition->readSubsets(_partition_file_name);
+                _data->setPartition(partition);
+            }
+            _data->getDataFromFile(_data_file_name, formats.at(_data_format));
+            fmt::print(FMT_STRING("Read {:d} taxa and {:d} sites from {:s}, compressed to {:d} patterns\n"),
+                       _data->getNumTaxa(), _data->getNumSites(), _data_file_name, _data->getNumPatterns());
+            if (!_partition_file_name.empty()) {
+                fmt::print(FMT_STRING("Sites divided into {:d} subsets: {}\n"), _data->getNumSubsets(), fmt::join(_data->getSubsetNames(), ", "));
+            }
+        } else if (!_partition_file_name.empty()) {
+            throw XStrom("--partition needs a data file");
+        }
+
+        // Compare independent runs
+        if (!_run_file_names.empty()) {
+            showASDSF();
+            if (_tree_file_name.empty()) {
+                std::cout << "Finished!" << std::endl;
+                return;
+            }
+        }
+
         // Create new TreeSummary
         _tree_summary = std::make_shared<TreeSummary>();
+        _tree_summary->setParseCache(_use_parse_cache);
+        _tree_summary->setTopK(_top_k);
+        _tree_summary->setEdgeLengthSummaries(_show_edge_lengths);
+        if (_top_k > 0 && (!_outgroup.empty() || !_patristic_file_name.empty() || !_topology_table_file_name.empty() || !_split_table_file_name.empty() || _show_edge_lengths || _ess_traces > 0)) {
+            throw XStrom("--outgroup, --patristic, --edge-lengths, --ess and the tables need every tree to be stored, so cannot be combined with --top-k");
+        }
+        if (_top_k > 0 && (_use_parse_cache || _compact_summary)) {
+            throw XStrom("--parse-cache and --compact-summary do not apply to --top-k, which hashes each tree without storing it and lists only the top topologies");
+        }
+
+        // Score the trees as they are read, without storing them
+        if (_score_trees) {
+            if (_follow || _top_k > 0 || _calc_likelihood || _validate_precision || _benchmark || _benchmark_newick || !_outgroup.empty() || !_patristic_file_name.empty() ||
+                !_topology_table_file_name.empty() || !_split_table_file_name.empty() || _use_parse_cache || _compact_summary || _show_credible_sets ||
+                _show_edge_lengths || _ess_traces > 0) {
+                throw XStrom("--score-trees reads the trees one at a time without storing them, so cannot be combined with --follow, --top-k, the other likelihood options or the tree summaries");
+            }
+            scoreTrees();
+            std::cout << "Finished!" << std::endl;
+            return;
+        }
+        if (!_scores_file_name.empty() || !_site_file_name.empty()) {
+            throw XStrom("--scores and --site-log-likelihoods need --score-trees");
+        }
 
         // Read the user-specified tree file
-        _tree_summary->readTreefile(_tree_file_name, 0);
-        Tree::SharedPtr tree = _tree_summary->getTree(0);
+        if (_follow) {
+            followTreefile();
+        } else {
+            _tree_summary->readTreefile(_tree_file_name, 0);
+        }
+        if (_calc_likelihood) {
+            showLikelihood();
+        }
+        if (_validate_precision) {
+            validatePrecision();
+        }
+        if (_benchmark) {
+            benchmarkLikelihood();
+        }
+        if (_benchmark_newick) {
+            benchmarkNewick();
+        }
 
-        // Summarise the trees read
-        _tree_summary->showSummary();
+        // Reroot every tree at the outgroup (taxon numbers are 1-based on the command line)
+        if (!_outgroup.empty()) {
+            std::vector<unsigned> outgroup;
+            for (auto taxon : _outgroup) {
+                if (taxon == 0) {
+                    throw XStrom("Outgroup taxon numbers start at 1");
+                }
+                outgroup.push_back(taxon - 1);
+            }
+            _tree_summary->rerootAtOutgroup(outgroup, TreeManip::round_trip_precision, _nthreads);
+            fmt::print(FMT_STRING("Rerooted trees at outgroup {}\n"), fmt::join(_outgroup, ","));
+        }
+
+        // Average leaf-to-leaf distances over the sample
+        if (!_patristic_file_name.empty()) {
+            auto distances = _tree_summary->calcMeanPatristicDistances<double>(_nthreads);
+            distances.writeBinary(_patristic_file_name);
+            fmt::print(FMT_STRING("Wrote {0:d} x {0:d} mean patristic distance matrix to {1:s}\n"), distances.getNumTaxa(), _patristic_file_name);
+        }
+
+        showSummaries();
     } catch (XStrom &x) {
         std::cerr << "Strom encountered a problem:\n " << x.what() << std::endl;
     }
@@ -81,4 +322,587 @@ inline void Strom::run() {
     std::cout << "Finished!" << std::endl;
 }
 
+/*
+ * Write the requested tables and summaries of the trees read so far.
+ */
+inline void Strom::showSummaries() const {
+    // Machine-readable frequency tables
+    TableFormat table_format = parseTableFormat(_table_format);
+    if (!_topology_table_file_name.empty()) {
+        _tree_summary->writeTopologyTable(_topology_table_file_name, table_format, _background_flush);
+        fmt::print(FMT_STRING("Wrote topology table to {:s}\n"), _topology_table_file_name);
+    }
+    if (!_split_table_file_name.empty()) {
+        _tree_summary->writeSplitTable(_split_table_file_name, table_format, _background_flush);
+        fmt::print(FMT_STRING("Wrote split table to {:s}\n"), _split_table_file_name);
+    }
+
+    // Summarise the trees read
+    _tree_summary->showSummary(!_compact_summary);
+    if (_show_credible_sets && !_tree_summary->isStreaming()) {
+        _tree_summary->showCredibleSets();
+    }
+    if (_show_edge_lengths) {
+        _tree_summary->showEdgeLengthSummary();
+    }
+    if (_ess_traces > 0) {
+        _tree_summary->showESSSummary(_ess_traces, _nthreads);
+    }
+}
+
+/*
+ * Poll the tree file for appended tree statements until its TREES block is
+ * closed, adding each new tree to the summary and showing the summaries
+ * every _follow_interval seconds if new trees have arrived. The file is
+ * polled rather than watched, which works on network filesystems too.
+ */
+inline void Strom::followTreefile() {
+    using clock = std::chrono::steady_clock;
+    TreeFileFollower follower;
+    follower.open(_tree_file_name);
+    TreeManip tm;
+    Split::treeid_t splitset;
+
+    unsigned long ntrees = 0;
+    unsigned long nnew = 0;
+    auto last_summary = clock::now();
+    while (true) {
+        unsigned n = follower.poll([&](const std::string &newick) { _tree_summary->storeTree(tm, newick, splitset); });
+        ntrees += n;
+        nnew += n;
+        if (follower.isFinished()) {
+            break;
+        }
+
+        if (nnew > 0 && clock::now() - last_summary >= std::chrono::duration<double>(_follow_interval)) {
+            fmt::print(FMT_STRING("\n[{:d} trees read from {:s} so far]\n"), ntrees, _tree_file_name);
+            showSummaries();
+            std::cout << std::flush;
+            last_summary = clock::now();
+            nnew = 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(_poll_interval));
+    }
+    _tree_summary->setTaxonNames(follower.getTaxonNames());
+    fmt::print(FMT_STRING("\nTREES block of {:s} closed after {:d} trees\n"), _tree_file_name, ntrees);
+}
+
+// Equal-rates model with the rate variation of --gamma-categories and --pinvar
+inline Model::SharedPtr Strom::createModel() const {
+    auto model = std::make_shared<Model>();
+    model->setNumStates(_data->getNumStates());
+    model->setGammaShape(_gamma_shape);
+    model->setGammaCategories(_gamma_categories, _gamma_median);
+    model->setProportionInvariable(_pinvar);
+    return model;
+}
+
+/*
+ * Leaves are matched to the data by the taxon names of the tree file. Give
+ * each data subset its own equal-rates model, with the rate variation
+ * across sites of --gamma-categories and --pinvar. Relative rates given by
+ * --subset-rates are rescaled so that their mean, weighted by the number of
+ * sites in each subset, is 1; edge lengths then remain expected
+ * substitutions per site.
+ */
+inline void Strom::configureLikelihood(Likelihood &likelihood) const {
+    unsigned nsubsets = _data->getNumSubsets();
+    if (!_subset_rates.empty() && _subset_rates.size() != nsubsets) {
+        throw XStrom(fmt::format(FMT_STRING("--subset-rates gives {:d} rates, but the data have {:d} subsets"), _subset_rates.size(), nsubsets));
+    }
+    double mean_rate = 1.0;
+    if (!_subset_rates.empty()) {
+        mean_rate = 0.0;
+        for (unsigned k = 0; k < nsubsets; ++k) {
+            mean_rate += _subset_rates[k] * _data->getSubsetNumSites(k);
+        }
+        mean_rate /= _data->getNumSites();
+    }
+
+    if (_tree_summary->getTaxonNames().empty()) {
+        throw XStrom(fmt::format(FMT_STRING("The taxon names of {:s} are unknown, so its leaves cannot be matched to the data"), _tree_file_name));
+    }
+    likelihood.setData(_data);
+    likelihood.setTaxonNames(_tree_summary->getTaxonNames());
+    for (unsigned k = 0; k < nsubsets; ++k) {
+        auto model = createModel();
+        if (!_subset_rates.empty()) {
+            model->setSubsetRelativeRate(_subset_rates[k] / mean_rate);
+        }
+        likelihood.setSubsetModel(k, model);
+    }
+    likelihood.setImplementation(_beagle_implementation);
+    likelihood.setThreadCount(_nthreads);
+}
+
+/*
+ * Log-likelihood of the first tree under the model set up by
+ * configureLikelihood, with the BEAGLE implementation used and the time
+ * taken.
+ */
+inline void Strom::showLikelihood() const {
+    if (!_data) {
+        throw XStrom("--likelihood needs a data file");
+    }
+    if (_tree_summary->isStreaming()) {
+        throw XStrom("--likelihood cannot be combined with --top-k");
+    }
+
+    Likelihood likelihood;
+    configureLikelihood(likelihood);
+    likelihood.setSinglePrecision(_single_precision);
+
+    Tree::SharedPtr tree = _tree_summary->getTree(0);
+    double log_likelihood = likelihood.calcLogLikelihood(*tree);
+    fmt::print(FMT_STRING("BEAGLE {:s}: {:s}\n"), Likelihood::beagleLibVersion(), likelihood.usedResources());
+    fmt::print(FMT_STRING("Log-likelihood of tree 1: {:.6f} ({:.3f} ms per evaluation)\n"), log_likelihood, 1000.0 * likelihood.getMeanEvaluationTime());
+}
+
+/*
+ * Log-likelihoods of every tree in single and double precision, with the
+ * largest differences. Fails if a relative difference exceeds
+ * _precision_tolerance.
+ */
+inline void Strom::validatePrecision() const {
+    if (!_data) {
+        throw XStrom("--validate-precision needs a data file");
+    }
+    if (_tree_summary->isStreaming()) {
+        throw XStrom("--validate-precision cannot be combined with --top-k");
+    }
+
+    Likelihood reference;
+    Likelihood single;
+    configureLikelihood(reference);
+    configureLikelihood(single);
+    single.setSinglePrecision(true);
+
+    double max_absolute = 0.0;
+    double max_relative = 0.0;
+    unsigned worst_tree = 0;
+    unsigned ntrees = _tree_summary->getNumTrees();
+    // Both engines score each tree, and the last tree is only released once
+    // the next one is built, so no tree is ever taken for the one before
+    Tree::SharedPtr tree;
+    for (unsigned i = 0; i < ntrees; ++i) {
+        tree = _tree_summary->getTree(i);
+        double expected = reference.calcLogLikelihood(*tree);
+        double observed = single.calcLogLikelihood(*tree);
+        double absolute = std::fabs(observed - expected);
+        double relative = absolute / std::max(std::fabs(expected), 1.0);
+        max_absolute = std::max(max_absolute, absolute);
+        if (relative > max_relative) {
+            max_relative = relative;
+            worst_tree = i;
+        }
+    }
+
+    fmt::print(FMT_STRING("Single precision: {:s}\n"), single.usedResources());
+    fmt::print(FMT_STRING("Largest log-likelihood difference over {:d} trees: {:.3g} ({:.3g} relative, tree {:d})\n"), ntrees, max_absolute, max_relative,
+               worst_tree + 1);
+    fmt::print(FMT_STRING("Mean time per evaluation: {:.3f} ms double, {:.3f} ms single\n"), 1000.0 * reference.getMeanEvaluationTime(),
+               1000.0 * single.getMeanEvaluationTime());
+    if (max_relative > _precision_tolerance) {
+        throw XStrom(fmt::format(FMT_STRING("Single-precision log-likelihood of tree {:d} differs by {:.3g} (relative), more than the tolerance {:.3g}"),
+                                 worst_tree + 1, max_relative, _precision_tolerance));
+    }
+    fmt::print(FMT_STRING("All within the relative tolerance {:.3g}\n"), _precision_tolerance);
+}
+
+/*
+ * Time full evaluations of the first tree by the native engine and by BEAGLE
+ * (--beagle-impl, or BEAGLE's own choice if that is native) on the sites of
+ * the first 64, 128, 256, ... patterns and finally all of them, treated as
+ * one subset under the model of createModel. Each evaluation recomputes
+ * every transition matrix and partials buffer, and is repeated until it has
+ * run for benchmark_seconds; the mean time is shown.
+ */
+inline void Strom::benchmarkLikelihood() const {
+    if (!_data) {
+        throw XStrom("--benchmark needs a data file");
+    }
+    if (_tree_summary->isStreaming()) {
+        throw XStrom("--benchmark cannot be combined with --top-k");
+    }
+
+    const double benchmark_seconds = 0.5;
+    const unsigned min_repeats = 3;
+    std::string beagle_implementation = (_beagle_implementation == "native" ? "auto" : _beagle_implementation);
+    std::vector<unsigned> sizes;
+    for (unsigned n = 64; n < _data->getNumPatterns(); n *= 2) {
+        sizes.push_back(n);
+    }
+    sizes.push_back(_data->getNumPatterns());
+
+    Tree::SharedPtr tree = _tree_summary->getTree(0);
+    auto time_evaluation = [&](const Data::SharedPtr &data, const std::string &implementation, double &log_likelihood, std::string &resources) {
+        Likelihood likelihood;
+        likelihood.setData(data);
+        likelihood.setTaxonNames(_tree_summary->getTaxonNames());
+        likelihood.setModel(createModel());
+        likelihood.setImplementation(implementation);
+        likelihood.setThreadCount(_nthreads);
+        likelihood.setSinglePrecision(_single_precision);
+        log_likelihood = likelihood.calcLogLikelihood(*tree);
+        resources = likelihood.usedResources();
+        unsigned repeats = 0;
+        double seconds = 0.0;
+        while (repeats < min_repeats || seconds < benchmark_seconds) {
+            likelihood.invalidateBuffers();
+            auto start = std::chrono::steady_clock::now();
+            (void) likelihood.calcLogLikelihood(*tree);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ++repeats;
+        }
+        return seconds / repeats;
+    };
+
+    fmt::print(FMT_STRING("Full evaluations of tree 1 on {:d} threads\n"), _nthreads);
+    fmt::print(FMT_STRING("{:>10s} {:>8s} {:>12s} {:>12s} {:>8s} {:>12s}\n"), "patterns", "sites", "native ms", "BEAGLE ms", "ratio", "lnL diff");
+    std::string native_resources;
+    std::string beagle_resources;
+    for (unsigned npatterns : sizes) {
+        Data::SharedPtr data = _data->firstPatterns(npatterns);
+        double native_log_likelihood = 0.0;
+        double beagle_log_likelihood = 0.0;
+        double native_seconds = time_evaluation(data, "native", native_log_likelihood, native_resources);
+        double beagle_seconds = time_evaluation(data, beagle_implementation, beagle_log_likelihood, beagle_resources);
+        fmt::print(FMT_STRING("{:>10d} {:>8d} {:>12.3f} {:>12.3f} {:>8.2f} {:>12.3g}\n"), npatterns, data->getNumSites(), 1000.0 * native_seconds,
+                   1000.0 * beagle_seconds, native_seconds / beagle_seconds, native_log_likelihood - beagle_log_likelihood);
+    }
+    fmt::print(FMT_STRING("Native: {:s}\nBEAGLE {:s}: {:s}\n"), native_resources, Likelihood::beagleLibVersion(), beagle_resources);
+}
+
+/*
+ * Time writing the first benchmark_trees trees as newick descriptions with
+ * each writer: the per-node fmt::format writer makeNewick replaced, makeNewick
+ * itself, appendNewick into one reused buffer, and makeNewick with edge
+ * lengths in round-trip form. Each pass over the trees is repeated until the
+ * writer has run for benchmark_seconds; the mean time per tree is shown.
+ */
+inline void Strom::benchmarkNewick() const {
+    if (_tree_summary->isStreaming()) {
+        throw XStrom("--benchmark-newick cannot be combined with --top-k");
+    }
+
+    const unsigned benchmark_trees = 1000;
+    const double benchmark_seconds = 0.5;
+    const unsigned min_repeats = 3;
+    const unsigned precision = 5;
+    unsigned ntrees = std::min(benchmark_trees, _tree_summary->getNumTrees());
+    if (ntrees == 0) {
+        throw XStrom("--benchmark-newick needs at least one tree");
+    }
+    std::vector<TreeManip> trees;
+    trees.reserve(ntrees);
+    for (unsigned i = 0; i < ntrees; ++i) {
+        trees.emplace_back(_tree_summary->getTree(i));
+        if (trees.back().makeNewickFormatted(precision) != trees.back().makeNewick(precision)) {
+            throw XStrom(fmt::format(FMT_STRING("The newick writers disagree on tree {:d}"), i + 1));
+        }
+    }
+
+    // Returns the mean seconds per tree; bytes is set to the characters written per pass
+    auto time_writer = [&](auto write, std::size_t &bytes) {
+        unsigned repeats = 0;
+        double seconds = 0.0;
+        while (repeats < min_repeats || seconds < benchmark_seconds) {
+            bytes = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (auto &tm : trees) {
+                bytes += write(tm);
+            }
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ++repeats;
+        }
+        return seconds / (static_cast<double>(repeats) * ntrees);
+    };
+
+    fmt::memory_buffer reused;
+    std::vector<std::pair<std::string, std::function<std::size_t(const TreeManip &)>>> writers = {
+        {"fmt::format per node", [](const TreeManip &tm) { return tm.makeNewickFormatted(precision).size(); }},
+        {"makeNewick", [](const TreeManip &tm) { return tm.makeNewick(precision).size(); }},
+        {"appendNewick, reused buffer", [&reused](const TreeManip &tm) {
+             reused.clear();
+             tm.appendNewick(reused, precision);
+             return reused.size();
+         }},
+        {"makeNewick, round-trip", [](const TreeManip &tm) { return tm.makeNewick(TreeManip::round_trip_precision).size(); }}};
+
+    fmt::print(FMT_STRING("Writing {:d} trees of {:d} taxa with {:d} decimal places\n"), ntrees, trees.front().getTree()->numLeaves(), precision);
+    fmt::print(FMT_STRING("{:<28s} {:>12s} {:>10s} {:>8s}\n"), "writer", "us per tree", "MB/s", "speedup");
+    double baseline = 0.0;
+    for (auto &[name, write] : writers) {
+        std::size_t bytes = 0;
+        double seconds = time_writer(write, bytes);
+        if (baseline == 0.0) {
+            baseline = seconds;
+        }
+        fmt::print(FMT_STRING("{:<28s} {:>12.2f} {:>10.1f} {:>8.2f}\n"), name, 1.0e6 * seconds, bytes / (seconds * ntrees) / 1.0e6, baseline / seconds);
+    }
+}
+
+/*
+ * Log-likelihood of every tree under fixed model parameters. The tree file
+ * is read one statement at a time by a TreeFileFollower, which hands batches
+ * of consecutive tree descriptions to the worker threads through a bounded
+ * OrderedQueue, so memory does not grow with the number of trees. Each
+ * worker scores its trees with its own Likelihood, which recomputes only the
+ * partials of subtrees that differ from the tree before, so runs of similar
+ * trees from an MCMC sample are cheap. A tree is kept until the next one is
+ * built so that the two are never confused.
+ *
+ * Workers put each score, with the tree's pattern log-likelihoods if they
+ * are wanted, into a second OrderedQueue holding site_queue_bytes of rows,
+ * and a writer thread writes them out in tree order while scoring goes on.
+ * An empty batch after the last marks the end of the file.
+ */
+inline void Strom::scoreTrees() {
+    if (!_data) {
+        throw XStrom("--score-trees needs a data file");
+    }
+    if (!std::filesystem::exists(_tree_file_name)) {
+        throw XStrom(fmt::format(FMT_STRING("Could not open tree file {:s}"), _tree_file_name));
+    }
+
+    struct TreeScore {
+        double log_likelihood = 0.0;
+        std::vector<double> site_log_likelihoods;
+        bool last = false;
+    };
+
+    const std::size_t site_queue_bytes = std::size_t(1) << 26;
+    const unsigned max_queue_size = 1 << 16;
+    const unsigned max_batch_size = 32;
+    unsigned nworkers = std::max(1u, _nthreads);
+    bool write_sites = !_site_file_name.empty();
+    unsigned queue_size = 2 * nworkers * max_batch_size;
+    unsigned batch_size = max_batch_size;
+    SiteLikelihoodWriter site_writer;
+    if (write_sites) {
+        std::size_t row_bytes = sizeof(double) * _data->getNumPatterns();
+        queue_size = static_cast<unsigned>(std::clamp<std::size_t>(site_queue_bytes / row_bytes, 2 * nworkers, std::max(max_queue_size, 2 * nworkers)));
+        // short enough batches that every worker can have two in the queue
+        batch_size = std::clamp(queue_size / (2 * nworkers), 1u, max_batch_size);
+        site_writer.open(_site_file_name, _data);
+    }
+    OutputBuffer scores_out;
+    if (!_scores_file_name.empty()) {
+        scores_out.open(_scores_file_name, _background_flush);
+        scores_out.write("tree,log_likelihood\n");
+    }
+    OrderedQueue<std::vector<std::string>> batches(2 * nworkers);
+    OrderedQueue<TreeScore> scores(queue_size);
+    std::mutex batch_mutex;
+    unsigned long next_batch = 0;
+
+    std::vector<Likelihood::SharedPtr> likelihoods(nworkers);
+    std::vector<unsigned long> partials_total(nworkers, 0);
+    unsigned long ntrees = 0;
+    double lowest = 0.0;
+    double highest = 0.0;
+    unsigned long lowest_tree = 0;
+    unsigned long highest_tree = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::exception_ptr writer_error;
+    std::thread writer([&] {
+        try {
+            for (unsigned long i = 0;; ++i) {
+                TreeScore *score = scores.front();
+                if (!score || score->last) {
+                    return;
+                }
+                if (i == 0 || score->log_likelihood < lowest) {
+                    lowest = score->log_likelihood;
+                    lowest_tree = i;
+                }
+                if (i == 0 || score->log_likelihood > highest) {
+                    highest = score->log_likelihood;
+                    highest_tree = i;
+                }
+                if (scores_out.isOpen()) {
+                    scores_out.print(FMT_STRING("{:d},{:.10g}\n"), i + 1, score->log_likelihood);
+                }
+                if (write_sites) {
+                    site_writer.addSample(score->site_log_likelihoods);
+                }
+                scores.pop();
+            }
+        } catch (...) {
+            writer_error = std::current_exception();
+            scores.close();
+            batches.close();
+        }
+    });
+
+    // The workers start at the first tree, once the taxa of the file are known
+    TreeFileFollower reader;
+    reader.open(_tree_file_name);
+    std::exception_ptr scoring_error;
+    std::thread scorer;
+    auto startScoring = [&] {
+        _tree_summary->setTaxonNames(reader.getTaxonNames());
+        for (auto &likelihood : likelihoods) {
+            likelihood = std::make_shared<Likelihood>();
+            configureLikelihood(*likelihood);
+            likelihood->setSinglePrecision(_single_precision);
+            likelihood->setThreadCount(1);
+        }
+        scorer = std::thread([&] {
+            try {
+                parallelFor(nworkers, nworkers, [&](unsigned, unsigned, unsigned worker) {
+                    Likelihood &likelihood = *likelihoods[worker];
+                    TreeManip tm;
+                    Tree::SharedPtr tree;
+                    std::vector<std::string> newicks;
+                    try {
+                        while (true) {
+                            unsigned long first;
+                            {
+                                std::lock_guard<std::mutex> lock(batch_mutex);
+                                std::vector<std::string> *batch = batches.front();
+                                if (!batch || batch->empty()) {
+                                    // the end marker stays in the queue for the other workers
+                                    return;
+                                }
+                                newicks.swap(*batch);
+                                batches.pop();
+                                first = next_batch++ * batch_size;
+                            }
+                            for (unsigned j = 0; j < newicks.size(); ++j) {
+                                tm.buildFromNewick(newicks[j], false, false);
+                                tree = tm.getTree();
+                                double log_likelihood = likelihood.calcLogLikelihood(*tree);
+                                partials_total[worker] += tree->numInternals();
+                                TreeScore *score = scores.reserve(first + j);
+                                if (!score) {
+                                    return;
+                                }
+                                score->log_likelihood = log_likelihood;
+                                if (write_sites) {
+                                    likelihood.getPatternLogLikelihoods(score->site_log_likelihoods);
+                                }
+                                scores.push(first + j);
+                            }
+                        }
+                    } catch (...) {
+                        // the tree will never be pushed, so release the reader, the other workers and the writer
+                        scores.close();
+                        batches.close();
+                        throw;
+                    }
+                });
+            } catch (...) {
+                scoring_error = std::current_exception();
+            }
+        });
+    };
+
+    std::vector<std::string> batch;
+    unsigned long nbatches = 0;
+    auto pushBatch = [&] {
+        std::vector<std::string> *slot = batches.reserve(nbatches);
+        if (slot) {
+            // the slot gets the batch, and the batch the slot's old strings to reuse
+            slot->swap(batch);
+            batches.push(nbatches);
+        }
+        ++nbatches;
+        batch.clear();
+    };
+    std::exception_ptr reading_error;
+    try {
+        reader.poll([&](const std::string &newick) {
+            if (!scorer.joinable()) {
+                startScoring();
+            }
+            batch.push_back(newick);
+            ++ntrees;
+            if (batch.size() == batch_size) {
+                pushBatch();
+            }
+        });
+        reader.checkComplete();
+        if (!batch.empty()) {
+            pushBatch();
+        }
+        pushBatch();
+    } catch (...) {
+        reading_error = std::current_exception();
+        batches.close();
+        scores.close();
+    }
+    if (scorer.joinable()) {
+        scorer.join();
+    }
+    if (!reading_error && !scoring_error) {
+        TreeScore *end = scores.reserve(ntrees);
+        if (end) {
+            end->last = true;
+            scores.push(ntrees);
+        }
+    }
+    writer.join();
+    if (reading_error) {
+        std::rethrow_exception(reading_error);
+    }
+    if (scoring_error) {
+        std::rethrow_exception(scoring_error);
+    }
+    if (writer_error) {
+        std::rethrow_exception(writer_error);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (ntrees == 0) {
+        fmt::print(FMT_STRING("No trees to score in {:s}\n"), _tree_file_name);
+    } else {
+        unsigned long updates = 0;
+        for (auto &likelihood : likelihoods) {
+            updates += likelihood->getNumPartialsUpdates();
+        }
+        unsigned long total = std::accumulate(partials_total.begin(), partials_total.end(), 0ul);
+        fmt::print(FMT_STRING("BEAGLE {:s}: {:s}\n"), Likelihood::beagleLibVersion(), likelihoods[0]->usedResources());
+        fmt::print(FMT_STRING("Scored {:d} trees in {:.3f} s on {:d} threads ({:.1f} trees/s), recomputing {:.1f}% of partials\n"), ntrees, seconds, nworkers,
+                   seconds > 0.0 ? ntrees / seconds : 0.0, total > 0 ? 100.0 * updates / total : 0.0);
+        fmt::print(FMT_STRING("Log-likelihoods range from {:.6f} (tree {:d}) to {:.6f} (tree {:d})\n"), lowest, lowest_tree + 1, highest, highest_tree + 1);
+    }
+
+    if (scores_out.isOpen()) {
+        scores_out.close();
+        fmt::print(FMT_STRING("Wrote log-likelihoods to {:s}\n"), _scores_file_name);
+    }
+    if (write_sites) {
+        unsigned long nsamples = site_writer.getNumSamples();
+        site_writer.close();
+        fmt::print(FMT_STRING("Wrote log-likelihoods of {:d} sites under {:d} trees to {:s}\n"), _data->getNumSites(), nsamples, _site_file_name);
+    }
+}
+
+/*
+ * Read the trees of each run into an ASDSFCalculator and report the average
+ * standard deviation of split frequencies between the runs.
+ */
+inline void Strom::showASDSF() const {
+    ASDSFCalculator asdsf;
+    asdsf.setNumRuns(static_cast<unsigned>(_run_file_names.size()));
+    asdsf.setMinFrequency(_asdsf_min_frequency);
+    asdsf.setWindowFraction(_asdsf_window_fraction);
+
+    TreeManip tm;
+    Split::treeid_t splitset;
+    for (unsigned run = 0; run < _run_file_names.size(); ++run) {
+        forEachNewick(_run_file_names[run], 0, [&](const std::string &newick, unsigned, const std::vector<std::string> &) {
+            tm.buildFromNewick(newick, false, false);
+            splitset.clear();
+            tm.storeSplits(splitset);
+            asdsf.addTree(run, splitset);
+        });
+        fmt::print(FMT_STRING("Run {:d}: read {:d} trees from {:s}, using the last {:d}\n"),
+                   run + 1, asdsf.getNumTrees(run), _run_file_names[run], asdsf.getWindowSize(run));
+    }
+    fmt::print(FMT_STRING("ASDSF (minimum split frequency {:g}): {:.6f}\n"), _asdsf_min_frequency, asdsf.calcASDSF());
+}
+
 }// namespace strom
\ No newline at end of file
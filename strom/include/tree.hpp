@@ -5,19 +5,26 @@
 #pragma once
 
 #include "node.hpp"
+#include <atomic>
 #include <iostream>
 #include <memory>
 
 namespace strom {
 
 class TreeManip;
-//class Likelihood;
+class LCAIndex;
+template<typename T>
+class PatristicCalculator;
+class Likelihood;
 //class Updater;
 
 class Tree {
 
     friend class TreeManip;
-    //friend class Likelihood;
+    friend class LCAIndex;
+    template<typename T>
+    friend class PatristicCalculator;
+    friend class Likelihood;
     //friend class Updater;
 
 public:
@@ -34,6 +41,10 @@ public:
 private:
     void clear();
 
+    void markAllDirty();
+
+    static unsigned long newSerial();
+
     bool _is_rooted;
     Node *_root;
     unsigned _nleaves;
@@ -41,6 +52,15 @@ private:
     Node::PtrVector _preorder;
     Node::PtrVector _levelorder;
     Node::Vector _nodes;
+    Node::PtrVector _node_index;
+    bool _levelorder_stale;
+    unsigned _topology_version;
+
+    // Unique to this tree (renewed by clear), so that a tree built where an
+    // old one was freed is not taken for it; and the serial of the Likelihood
+    // that last cleared the dirty flags of the nodes (0 if none)
+    unsigned long _serial;
+    mutable unsigned long _likelihood_serial;
 
 public:
     typedef std::shared_ptr<Tree> SharedPtr;
@@ -56,8 +76,26 @@ inline void Tree::clear() {
     _nleaves = 0;
     _ninternals = 0;
     _nodes.clear();
+    _node_index.clear();
     _preorder.clear();
     _levelorder.clear();
+    _levelorder_stale = false;
+    _topology_version = 0;
+    _serial = newSerial();
+    _likelihood_serial = 0;
+}
+
+inline unsigned long Tree::newSerial() {
+    static std::atomic<unsigned long> next(1);
+    return next++;
+}
+
+// Every partial and transition matrix must be recomputed, e.g. after rerooting
+inline void Tree::markAllDirty() {
+    for (auto &nd : _nodes) {
+        nd._partials_dirty = true;
+        nd._tmatrix_dirty = true;
+    }
 }
 
 inline bool Tree::isRooted() const {
@@ -0,0 +1,434 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#pragma once
+
+#include "xstrom.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace strom {
+
+/*
+ * Reads the tree statements of a NEXUS tree file, one statement at a time,
+ * including a file that is still being written. Each poll reads only the
+ * bytes appended since the previous one and splits them into statements at
+ * semicolons outside comments and quoted labels, so an incomplete final
+ * statement is simply carried over to the next poll, and memory does not
+ * grow with the number of trees. Reading stops at the end of the first
+ * TREES block.
+ *
+ * Leaves are renumbered as NCL would: a label is looked up in the translate
+ * table, and the taxon it names is numbered by its position in the TAXA
+ * block. Without a TAXA block the taxa are those of the translate table, or
+ * failing that the leaf labels in order of first appearance. As in NCL,
+ * underscores in unquoted labels stand for spaces.
+ */
+class TreeFileFollower {
+public:
+    TreeFileFollower();
+
+    void open(const std::string &filename);
+
+    template<typename Function>
+    unsigned poll(Function fn);
+
+    [[nodiscard]] bool isFinished() const { return _finished; }
+
+    [[nodiscard]] bool isInTreesBlock() const { return _in_trees_block; }
+
+    [[nodiscard]] bool hasUnfinishedStatement() const;
+
+    void checkComplete() const;
+
+    [[nodiscard]] std::uint64_t getOffset() const { return _offset; }
+
+    [[nodiscard]] const std::vector<std::string> &getTaxonNames() const { return _taxon_names; }
+
+    void clear();
+
+private:
+    template<typename Function>
+    void handleStatement(Function &fn, unsigned &ntrees);
+
+    static std::string nextWord(const std::string &statement, std::size_t &pos);
+
+    static bool nextLabel(const std::string &statement, std::size_t &pos, std::string &label);
+
+    static std::string extractNewick(const std::string &statement, std::size_t pos);
+
+    void readTaxLabels(std::size_t pos);
+
+    void readTranslate(std::size_t pos);
+
+    unsigned addTaxon(const std::string &name);
+
+    unsigned taxonNumber(const std::string &label);
+
+    std::string renumberLeaves(const std::string &newick);
+
+    std::string _filename;
+    std::uint64_t _offset;
+    std::vector<char> _chunk;
+
+    // Scanner state carried between polls
+    std::string _statement;
+    unsigned _comment_depth;
+    bool _in_quote;
+    bool _in_trees_block;
+    bool _in_taxa_block;
+    bool _finished;
+
+    // Taxa, in the order that defines leaf numbers, and the translate table
+    std::vector<std::string> _taxon_names;
+    std::unordered_map<std::string, unsigned> _taxon_numbers;// 1-based
+    std::unordered_map<std::string, std::string> _translate;
+    bool _taxa_block_read;
+
+public:
+    typedef std::shared_ptr<TreeFileFollower> SharedPtr;
+};
+
+inline TreeFileFollower::TreeFileFollower() {
+    clear();
+}
+
+inline void TreeFileFollower::clear() {
+    _filename = "";
+    _offset = 0;
+    _chunk.clear();
+    _statement.clear();
+    _comment_depth = 0;
+    _in_quote = false;
+    _in_trees_block = false;
+    _in_taxa_block = false;
+    _finished = false;
+    _taxon_names.clear();
+    _taxon_numbers.clear();
+    _translate.clear();
+    _taxa_block_read = false;
+}
+
+inline void TreeFileFollower::open(const std::string &filename) {
+    clear();
+    _filename = filename;
+    _chunk.resize(1 << 20);
+}
+
+/*
+ * Read whatever has been appended to the file and call fn(newick) for each
+ * complete tree statement in it. Returns the number of trees found. A file
+ * that does not exist yet is treated as empty.
+ */
+template<typename Function>
+inline unsigned TreeFileFollower::poll(Function fn) {
+    std::error_code error;
+    std::uint64_t size = std::filesystem::file_size(_filename, error);
+    if (error || size == _offset) {
+        return 0;
+    }
+    if (size < _offset) {
+        throw XStrom(fmt::format(FMT_STRING("{:s} shrank from {:d} to {:d} bytes while being followed"), _filename, _offset, size));
+    }
+
+    std::ifstream in(_filename, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    in.seekg(static_cast<std::streamoff>(_offset));
+
+    unsigned ntrees = 0;
+    while (_offset < size && !_finished) {
+        auto nwanted = static_cast<std::streamsize>(std::min<std::uint64_t>(_chunk.size(), size - _offset));
+        in.read(_chunk.data(), nwanted);
+        std::streamsize nread = in.gcount();
+        if (nread <= 0) {
+            break;
+        }
+        _offset += static_cast<std::uint64_t>(nread);
+
+        for (std::streamsize i = 0; i < nread; ++i) {
+            char c = _chunk[i];
+            if (_comment_depth > 0) {
+                if (c == '[') {
+                    ++_comment_depth;
+                } else if (c == ']') {
+                    --_comment_depth;
+                }
+            } else if (_in_quote) {
+                // a doubled quote inside a label toggles twice, so needs no special case
+                _in_quote = (c != '\'');
+            } else if (c == '[') {
+                _comment_depth = 1;
+            } else if (c == '\'') {
+                _in_quote = true;
+            } else if (c == ';') {
+                handleStatement(fn, ntrees);
+                _statement.clear();
+                continue;
+            }
+            _statement += c;
+        }
+    }
+    return ntrees;
+}
+
+// Whether the text read so far ends inside a statement, comment or quoted label
+inline bool TreeFileFollower::hasUnfinishedStatement() const {
+    return (_comment_depth > 0 || _in_quote || _statement.find_first_not_of(" \t\r\n") != std::string::npos);
+}
+
+// For a file read in one go: fail if it ended before its last statement or TREES block did
+inline void TreeFileFollower::checkComplete() const {
+    if (hasUnfinishedStatement()) {
+        throw XStrom(fmt::format(FMT_STRING("Tree file {:s} ends in the middle of a statement"), _filename));
+    }
+    if (_in_trees_block) {
+        throw XStrom(fmt::format(FMT_STRING("Tree file {:s} ends before the end of its TREES block"), _filename));
+    }
+}
+
+template<typename Function>
+inline void TreeFileFollower::handleStatement(Function &fn, unsigned &ntrees) {
+    std::size_t pos = 0;
+    std::string command = nextWord(_statement, pos);
+    if (command == "#nexus") {
+        command = nextWord(_statement, pos);
+    }
+
+    if (command == "begin") {
+        std::string block = nextWord(_statement, pos);
+        _in_trees_block = (block == "trees");
+        _in_taxa_block = (block == "taxa");
+    } else if (command == "end" || command == "endblock") {
+        if (_in_trees_block) {
+            _finished = true;
+        }
+        _in_trees_block = false;
+        _in_taxa_block = false;
+    } else if (_in_taxa_block && command == "taxlabels") {
+        readTaxLabels(pos);
+    } else if (_in_trees_block && command == "translate") {
+        readTranslate(pos);
+    } else if (_in_trees_block && (command == "tree" || command == "utree")) {
+        fn(renumberLeaves(extractNewick(_statement, pos)));
+        ++ntrees;
+    }
+}
+
+/*
+ * Next label of a statement, skipping whitespace, comments and commas.
+ * Quoted labels lose their quotes (a doubled quote stands for one), and
+ * underscores in unquoted labels become spaces. Returns false at the end
+ * of the statement.
+ */
+inline bool TreeFileFollower::nextLabel(const std::string &statement, std::size_t &pos, std::string &label) {
+    unsigned depth = 0;
+    while (pos < statement.size()) {
+        char c = statement[pos];
+        if (c == '[') {
+            ++depth;
+        } else if (c == ']' && depth > 0) {
+            --depth;
+        } else if (depth == 0 && c != ',' && !std::isspace(static_cast<unsigned char>(c))) {
+            break;
+        }
+        ++pos;
+    }
+    if (pos == statement.size()) {
+        return false;
+    }
+
+    label.clear();
+    if (statement[pos] == '\'') {
+        for (++pos; pos < statement.size(); ++pos) {
+            if (statement[pos] == '\'') {
+                if (pos + 1 < statement.size() && statement[pos + 1] == '\'') {
+                    ++pos;
+                } else {
+                    ++pos;
+                    break;
+                }
+            }
+            label += statement[pos];
+        }
+        return true;
+    }
+    for (; pos < statement.size(); ++pos) {
+        char c = statement[pos];
+        if (std::isspace(static_cast<unsigned char>(c)) || c == ',' || c == '[' || c == ':' || c == '(' || c == ')') {
+            break;
+        }
+        label += (c == '_' ? ' ' : c);
+    }
+    return true;
+}
+
+inline void TreeFileFollower::readTaxLabels(std::size_t pos) {
+    _taxon_names.clear();
+    _taxon_numbers.clear();
+    std::string label;
+    while (nextLabel(_statement, pos, label)) {
+        addTaxon(label);
+    }
+    _taxa_block_read = true;
+}
+
+// Pairs of key and taxon label, separated by commas
+inline void TreeFileFollower::readTranslate(std::size_t pos) {
+    std::string key;
+    std::string label;
+    while (nextLabel(_statement, pos, key)) {
+        if (!nextLabel(_statement, pos, label)) {
+            throw XStrom(fmt::format(FMT_STRING("Translate table of {:s} ends with key {:s} and no taxon"), _filename, key));
+        }
+        _translate[key] = label;
+        if (!_taxa_block_read && _taxon_numbers.count(label) == 0) {
+            addTaxon(label);
+        }
+    }
+}
+
+inline unsigned TreeFileFollower::addTaxon(const std::string &name) {
+    auto [iter, inserted] = _taxon_numbers.emplace(name, static_cast<unsigned>(_taxon_names.size()) + 1);
+    if (!inserted) {
+        throw XStrom(fmt::format(FMT_STRING("Taxon {:s} appears twice in the taxa of {:s}"), name, _filename));
+    }
+    _taxon_names.push_back(name);
+    return iter->second;
+}
+
+/*
+ * A label that names no taxon may be a taxon number, if the taxa were
+ * listed, or otherwise adds a taxon.
+ */
+inline unsigned TreeFileFollower::taxonNumber(const std::string &label) {
+    auto translated = _translate.find(label);
+    const std::string &name = (translated != _translate.end() ? translated->second : label);
+    auto iter = _taxon_numbers.find(name);
+    if (iter != _taxon_numbers.end()) {
+        return iter->second;
+    }
+    if (!_taxa_block_read) {
+        return addTaxon(name);
+    }
+    if (!name.empty() && name.size() < 10 && std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        auto number = static_cast<unsigned>(std::stoul(name));
+        if (number >= 1 && number <= _taxon_names.size()) {
+            return number;
+        }
+    }
+    throw XStrom(fmt::format(FMT_STRING("Tree in {:s} has a leaf labelled {:s}, which is not one of its taxa"), _filename, label));
+}
+
+// Replace every leaf label (one following '(' or ',') with its taxon number
+inline std::string TreeFileFollower::renumberLeaves(const std::string &newick) {
+    std::string renumbered;
+    renumbered.reserve(newick.size());
+    std::string label;
+    std::size_t pos = 0;
+    unsigned depth = 0;
+    bool at_leaf = false;
+    while (pos < newick.size()) {
+        char c = newick[pos];
+        if (depth > 0) {
+            depth += (c == '[') - (c == ']');
+        } else if (c == '[') {
+            depth = 1;
+        } else if (c == '(' || c == ',') {
+            at_leaf = true;
+        } else if (at_leaf && c != ')' && c != ';' && c != ':') {
+            std::size_t end = pos;
+            nextLabel(newick, end, label);
+            fmt::format_to(std::back_inserter(renumbered), FMT_STRING("{:d}"), taxonNumber(label));
+            pos = end;
+            at_leaf = false;
+            continue;
+        } else {
+            at_leaf = false;
+        }
+        renumbered += c;
+        ++pos;
+    }
+    return renumbered;
+}
+
+// Next word of a statement, lower-cased, skipping whitespace and comments
+inline std::string TreeFileFollower::nextWord(const std::string &statement, std::size_t &pos) {
+    unsigned depth = 0;
+    while (pos < statement.size()) {
+        char c = statement[pos];
+        if (c == '[') {
+            ++depth;
+        } else if (c == ']' && depth > 0) {
+            --depth;
+        } else if (depth == 0 && !std::isspace(static_cast<unsigned char>(c))) {
+            break;
+        }
+        ++pos;
+    }
+    std::string word;
+    while (pos < statement.size()) {
+        char c = statement[pos];
+        if (std::isspace(static_cast<unsigned char>(c)) || c == '[' || c == '=') {
+            break;
+        }
+        word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        ++pos;
+    }
+    return word;
+}
+
+/*
+ * The description follows the first '=' outside comments and quotes (tree
+ * names may be quoted). Whitespace outside quoted labels is dropped.
+ */
+inline std::string TreeFileFollower::extractNewick(const std::string &statement, std::size_t pos) {
+    unsigned depth = 0;
+    bool in_quote = false;
+    for (; pos < statement.size(); ++pos) {
+        char c = statement[pos];
+        if (depth > 0) {
+            depth += (c == '[') - (c == ']');
+        } else if (in_quote) {
+            in_quote = (c != '\'');
+        } else if (c == '[') {
+            depth = 1;
+        } else if (c == '\'') {
+            in_quote = true;
+        } else if (c == '=') {
+            break;
+        }
+    }
+    if (pos == statement.size()) {
+        throw XStrom(fmt::format(FMT_STRING("Tree statement without '=': {:s}"), statement));
+    }
+
+    std::string newick;
+    newick.reserve(statement.size() - pos);
+    in_quote = false;
+    for (++pos; pos < statement.size(); ++pos) {
+        char c = statement[pos];
+        if (c == '\'') {
+            in_quote = !in_quote;
+        }
+        if (in_quote || !std::isspace(static_cast<unsigned char>(c))) {
+            newick += c;
+        }
+    }
+    newick += ';';
+    return newick;
+}
+
+}// namespace strom
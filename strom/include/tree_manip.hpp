@@ -4,10 +4,14 @@
 
 #pragma once
 
+#include "hash.hpp"
 #include "tree.hpp"
 #include "xstrom.hpp"
+#include <algorithm>
 #include <cassert>
-#include <fmt/core.h>
+#include <charconv>
+#include <fmt/format.h>
+#include <limits>
 #include <memory>
 #include <queue>
 #include <range/v3/view/reverse.hpp>
@@ -37,46 +41,129 @@ public:
 
     [[nodiscard]] std::string makeNewick(unsigned precision, bool use_names = false) const;
 
+    void appendNewick(fmt::memory_buffer &out, unsigned precision, bool use_names = false) const;
+
+    size_t writeNewick(char *buffer, size_t capacity, unsigned precision, bool use_names = false) const;
+
+    [[nodiscard]] size_t maxNewickLength(unsigned precision, bool use_names = false) const;
+
+    [[nodiscard]] std::string makeNewickFormatted(unsigned precision, bool use_names = false) const;
+
+    // Pass as precision to write edge lengths in their shortest round-trip form
+    static constexpr unsigned round_trip_precision = std::numeric_limits<unsigned>::max();
+
+    void ladderize(bool by_subtree_size = false);
+
+    [[nodiscard]] std::string makeCanonicalNewick(bool by_subtree_size = false);
+
+    [[nodiscard]] std::uint64_t calcTopologyHash(bool by_subtree_size = false);
+
     void buildFromNewick(const std::string &newick, bool rooted, bool allow_polytomies);
 
     void storeSplits(std::set<Split> &splitset);
 
+    void collectEdgeLengths(std::vector<double> &edge_lengths) const;
+
+    void stripOutNexusComments(std::string &newick) const;
+
     void rerootAtNodeNumber(int node_number);
 
+    void rerootAtOutgroup(const std::vector<unsigned> &outgroup);
+
+    void nniAtNodeNumber(int node_number, bool use_right_child);
+
+    void pruneAndRegraftAtNodeNumbers(int subtree_number, int target_number);
+
+    void swapSubtreesAtNodeNumbers(int first_number, int second_number);
+
+    void ensureLevelOrder();
+
+    void setValidateTraversals(bool validate);
+
     void clear();
 
 private:
+    Node *findNodeByNumber(int node_number);
+
     Node *findNextPreorder(Node *nd);
 
     void refreshPreorder();
 
+    void refreshPreorderIndices(unsigned begin, unsigned end);
+
     void refreshLevelOrder();
 
     void renumberInternals();
 
+    void refreshNodeIndex();
+
     void rerootAtNode(Node *prospective_root);
 
+    void nni(Node *nd, bool use_right_child);
+
+    void pruneAndRegraft(Node *subtree, Node *target);
+
+    void swapSubtrees(Node *first, Node *second);
+
+    [[nodiscard]] std::pair<unsigned, unsigned> findPreorderRange(Node *nd) const;
+
+    [[nodiscard]] bool isAncestorOf(Node *anc, Node *nd) const;
+
+    void replaceChild(Node *parent, Node *old_child, Node *new_child);
+
+    void validateTraversals();
+
     void extractNodeNumberFromName(Node *nd, std::set<unsigned> &used);
 
     void extractEdgeLen(Node *nd, const std::string &edge_length_string);
 
     [[nodiscard]] unsigned countNewickLeaves(const std::string &newick) const;
 
-    void stripOutNexusComments(std::string &newick) const;
-
     bool canHaveSibling(Node *nd, bool rooted, bool allow_polytomies);
 
+    template<typename Buffer>
+    void writeNewickTo(Buffer &out, unsigned precision, bool use_names, bool include_edge_lengths = true) const;
+
+    template<typename Buffer>
+    void writeEdgeLength(Buffer &out, double edge_length, unsigned precision) const;
+
+    template<typename Buffer>
+    void writeTipLabel(Buffer &out, const Node *nd, bool use_names) const;
+
+    // Bounds-checked output sink over a caller-supplied character array
+    struct FixedNewickBuffer {
+        char *curr;
+        char *last;
+
+        void push_back(char ch) {
+            if (curr == last) {
+                throw XStrom("Newick description does not fit in the supplied buffer");
+            }
+            *curr++ = ch;
+        }
+
+        void append(const char *first, const char *end) {
+            if (end - first > last - curr) {
+                throw XStrom("Newick description does not fit in the supplied buffer");
+            }
+            curr = std::copy(first, end, curr);
+        }
+    };
+
     Tree::SharedPtr _tree;
+    bool _validate_traversals;
 
 public:
     typedef std::shared_ptr<TreeManip> SharedPtr;
 };
 
 inline TreeManip::TreeManip() {
+    _validate_traversals = false;
     clear();
 }
 
 inline TreeManip::TreeManip(Tree::SharedPtr t) {
+    _validate_traversals = false;
     clear();
     setTree(t);
 }
@@ -85,6 +172,10 @@ inline void TreeManip::clear() {
     _tree.reset();
 }
 
+inline void TreeManip::setValidateTraversals(bool validate) {
+    _validate_traversals = validate;
+}
+
 inline void TreeManip::setTree(Tree::SharedPtr t) {
     assert(t);
     _tree = t;
@@ -188,12 +279,15 @@ inline void TreeManip::createTestTree() {
     _tree->_is_rooted = true;
     _tree->_root = root_node;
     _tree->_nleaves = 3;
+    _tree->_ninternals = 3;
+    refreshNodeIndex();
 
     _tree->_preorder.push_back(first_internal);
     _tree->_preorder.push_back(second_internal);
     _tree->_preorder.push_back(first_leaf);
     _tree->_preorder.push_back(second_leaf);
     _tree->_preorder.push_back(third_leaf);
+    refreshPreorderIndices(0, 5);
 
     _tree->_levelorder.push_back(first_internal);
     _tree->_levelorder.push_back(second_internal);
@@ -203,6 +297,48 @@ inline void TreeManip::createTestTree() {
 }
 
 inline std::string TreeManip::makeNewick(unsigned precision, bool use_names) const {
+    fmt::memory_buffer out;
+    appendNewick(out, precision, use_names);
+    return fmt::to_string(out);
+}
+
+inline void TreeManip::appendNewick(fmt::memory_buffer &out, unsigned precision, bool use_names) const {
+    out.reserve(out.size() + maxNewickLength(precision, use_names));
+    writeNewickTo(out, precision, use_names);
+}
+
+/*
+ * Write the newick description into buffer, which must have room for
+ * capacity characters (maxNewickLength gives a safe size). No terminating
+ * null is written. Returns the number of characters written.
+ */
+inline size_t TreeManip::writeNewick(char *buffer, size_t capacity, unsigned precision, bool use_names) const {
+    FixedNewickBuffer out{buffer, buffer + capacity};
+    writeNewickTo(out, precision, use_names);
+    return static_cast<size_t>(out.curr - buffer);
+}
+
+/*
+ * Upper bound on the length of the newick description, assuming edge lengths
+ * below 10^15 and no more than 20 significant digits in round-trip form.
+ */
+inline size_t TreeManip::maxNewickLength(unsigned precision, bool use_names) const {
+    size_t per_number = (precision == round_trip_precision ? 24 : precision + 17);
+    size_t length = 2 + (_tree->_preorder.size() + 1) * (per_number + 14);
+    if (use_names) {
+        for (auto &nd : _tree->_nodes) {
+            length += nd._name.size();
+        }
+    }
+    return length;
+}
+
+/*
+ * The writer makeNewick replaced, which formats every node with fmt::format
+ * into a growing string; kept as the baseline for --benchmark-newick. Its
+ * output is identical to makeNewick at a fixed precision.
+ */
+inline std::string TreeManip::makeNewickFormatted(unsigned precision, bool use_names) const {
     std::string newick;
     const auto tip_node_name_format = fmt::format("{{:s}}:{{:.{:d}f}}", precision);
     const auto tip_node_number_format = fmt::format("{{:d}}:{{:.{:d}f}}", precision);
@@ -211,6 +347,14 @@ inline std::string TreeManip::makeNewick(unsigned precision, bool use_names) con
 
     Node *root_tip = (_tree->_is_rooted ? nullptr : _tree->_root);
 
+    // An unrooted tree rerooted at an internal node has a basal polytomy
+    // rather than a root tip
+    if (root_tip && root_tip->_left_child && root_tip->_left_child->_right_sib) {
+        newick += "(";
+        node_stack.push(root_tip);
+        root_tip = nullptr;
+    }
+
     for (auto nd : _tree->_preorder) {
         if (nd->_left_child) {
             newick += "(";
@@ -256,6 +400,173 @@ inline std::string TreeManip::makeNewick(unsigned precision, bool use_names) con
     return newick + ";";
 }
 
+template<typename Buffer>
+inline void TreeManip::writeEdgeLength(Buffer &out, double edge_length, unsigned precision) const {
+    char digits[128];
+    std::to_chars_result result{};
+    if (precision == round_trip_precision) {
+        result = std::to_chars(digits, digits + sizeof(digits), edge_length);
+    } else {
+        result = std::to_chars(digits, digits + sizeof(digits), edge_length, std::chars_format::fixed, static_cast<int>(precision));
+    }
+    if (result.ec != std::errc()) {
+        throw XStrom(fmt::format(FMT_STRING("Could not format edge length {:g} with precision {:d}"), edge_length, precision));
+    }
+    out.push_back(':');
+    out.append(digits, result.ptr);
+}
+
+template<typename Buffer>
+inline void TreeManip::writeTipLabel(Buffer &out, const Node *nd, bool use_names) const {
+    if (use_names) {
+        out.append(nd->_name.data(), nd->_name.data() + nd->_name.size());
+    } else {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), nd->_number + 1);
+        out.append(digits, result.ptr);
+    }
+}
+
+template<typename Buffer>
+inline void TreeManip::writeNewickTo(Buffer &out, unsigned precision, bool use_names, bool include_edge_lengths) const {
+    Node::PtrVector node_stack;
+    node_stack.reserve(_tree->_nodes.size());
+
+    Node *root_tip = (_tree->_is_rooted ? nullptr : _tree->_root);
+
+    // An unrooted tree rerooted at an internal node has a basal polytomy
+    // rather than a root tip
+    if (root_tip && root_tip->_left_child && root_tip->_left_child->_right_sib) {
+        out.push_back('(');
+        node_stack.push_back(root_tip);
+        root_tip = nullptr;
+    }
+
+    for (auto nd : _tree->_preorder) {
+        if (nd->_left_child) {
+            out.push_back('(');
+            node_stack.push_back(nd);
+            if (root_tip) {
+                writeTipLabel(out, root_tip, use_names);
+                if (include_edge_lengths) {
+                    writeEdgeLength(out, nd->_edge_length, precision);
+                }
+                out.push_back(',');
+                root_tip = nullptr;
+            }
+        } else {
+            writeTipLabel(out, nd, use_names);
+            if (include_edge_lengths) {
+                writeEdgeLength(out, nd->_edge_length, precision);
+            }
+            if (nd->_right_sib) {
+                out.push_back(',');
+            } else {
+                Node *popped = (node_stack.empty() ? nullptr : node_stack.back());
+                while (popped && !popped->_right_sib) {
+                    node_stack.pop_back();
+                    out.push_back(')');
+                    if (node_stack.empty()) {
+                        popped = nullptr;
+                    } else {
+                        if (include_edge_lengths) {
+                            writeEdgeLength(out, popped->_edge_length, precision);
+                        }
+                        popped = node_stack.back();
+                    }
+                }
+                if (popped && popped->_right_sib) {
+                    node_stack.pop_back();
+                    out.push_back(')');
+                    if (include_edge_lengths) {
+                        writeEdgeLength(out, popped->_edge_length, precision);
+                    }
+                    out.push_back(',');
+                }
+            }
+        }
+    }
+    out.push_back(';');
+}
+
+/*
+ * Put the tree in a canonical form that depends only on its topology.
+ * Unrooted trees are first rerooted at leaf 0. The children of every node are
+ * then sorted by the smallest leaf number in their subtrees or, if
+ * by_subtree_size is true, by the number of leaves in their subtrees (ties
+ * broken by smallest leaf number).
+ */
+inline void TreeManip::ladderize(bool by_subtree_size) {
+    if (!_tree->_is_rooted && _tree->_root->_number != 0) {
+        rerootAtNodeNumber(0);
+    }
+
+    std::vector<unsigned> min_leaf(_tree->_node_index.size(), std::numeric_limits<unsigned>::max());
+    std::vector<unsigned> nleaves(_tree->_node_index.size(), 0);
+    Node::PtrVector children;
+
+    auto sort_children = [&](Node *nd) {
+        children.clear();
+        for (Node *c = nd->_left_child; c; c = c->_right_sib) {
+            children.push_back(c);
+        }
+        std::sort(children.begin(), children.end(), [&](Node *a, Node *b) {
+            if (by_subtree_size && nleaves[a->_number] != nleaves[b->_number]) {
+                return nleaves[a->_number] < nleaves[b->_number];
+            }
+            return min_leaf[a->_number] < min_leaf[b->_number];
+        });
+        nd->_left_child = children.front();
+        for (size_t i = 0; i + 1 < children.size(); ++i) {
+            children[i]->_right_sib = children[i + 1];
+        }
+        children.back()->_right_sib = nullptr;
+    };
+
+    for (auto nd : ranges::views::reverse(_tree->_preorder)) {
+        auto number = static_cast<unsigned>(nd->_number);
+        if (!nd->_left_child) {
+            min_leaf[number] = number;
+            nleaves[number] = 1;
+        } else if (nd->_left_child->_right_sib) {
+            sort_children(nd);
+        }
+
+        auto parent_number = static_cast<unsigned>(nd->_parent->_number);
+        min_leaf[parent_number] = std::min(min_leaf[parent_number], min_leaf[number]);
+        nleaves[parent_number] += nleaves[number];
+    }
+
+    // The root is not in _preorder, but may have several children after rerooting
+    Node *root = _tree->_root;
+    if (root->_left_child && root->_left_child->_right_sib) {
+        sort_children(root);
+    }
+
+    refreshPreorder();
+    _tree->_levelorder_stale = true;
+}
+
+/*
+ * Topology-only newick (leaf numbers, no edge lengths) of the ladderized tree.
+ * Two trees with the same topology give identical strings.
+ */
+inline std::string TreeManip::makeCanonicalNewick(bool by_subtree_size) {
+    ladderize(by_subtree_size);
+    fmt::memory_buffer out;
+    out.reserve(maxNewickLength(0));
+    writeNewickTo(out, 0, false, false);
+    return fmt::to_string(out);
+}
+
+/*
+ * Hash of the canonical newick string. The value is stable across runs and
+ * machines, so it can be used as a topology ID when comparing tree files.
+ */
+inline std::uint64_t TreeManip::calcTopologyHash(bool by_subtree_size) {
+    return hashBytes(makeCanonicalNewick(by_subtree_size));
+}
+
 inline void TreeManip::extractNodeNumberFromName(Node *nd, std::set<unsigned> &used) {
     assert(nd);
     unsigned x = 0;
@@ -294,9 +605,28 @@ inline unsigned TreeManip::countNewickLeaves(const std::string &newick) const {
     return static_cast<unsigned>(std::distance(m1, m2));
 }
 
+/*
+ * Remove square-bracketed comments in a single pass. An unterminated comment
+ * is left in place.
+ */
 inline void TreeManip::stripOutNexusComments(std::string &newick) const {
-    std::regex commentexpr("\\[.*?\\]");
-    newick = std::regex_replace(newick, commentexpr, std::string(""));
+    auto out = newick.begin();
+    auto comment_start = newick.end();
+    for (auto it = newick.begin(); it != newick.end(); ++it) {
+        if (comment_start != newick.end()) {
+            if (*it == ']') {
+                comment_start = newick.end();
+            }
+        } else if (*it == '[') {
+            comment_start = it;
+        } else {
+            *out++ = *it;
+        }
+    }
+    if (comment_start != newick.end()) {
+        out = std::copy(comment_start, newick.end(), out);
+    }
+    newick.erase(out, newick.end());
 }
 
 inline Node *TreeManip::findNextPreorder(Node *nd) {
@@ -331,6 +661,7 @@ inline Node *TreeManip::findNextPreorder(Node *nd) {
  */
 inline void TreeManip::refreshPreorder() {
     // Create a vector of Nodes in preorder sequence
+    ++_tree->_topology_version;
     _tree->_preorder.clear();
     _tree->_preorder.reserve(_tree->_nodes.size() - 1);// _preorder does not include the root node
 
@@ -340,8 +671,9 @@ inline void TreeManip::refreshPreorder() {
 
     Node *first_preorder = _tree->_root->_left_child;
 
-    // sanity check: the first preorder node should be the only child of the root
-    assert(first_preorder->_right_sib == nullptr);
+    // sanity check: the first preorder node should be the only child of the root,
+    // unless an unrooted tree has been rerooted at an internal node
+    assert(!_tree->_is_rooted || first_preorder->_right_sib == nullptr);
 
     Node *nd = first_preorder;
     _tree->_preorder.push_back(nd);
@@ -354,12 +686,21 @@ inline void TreeManip::refreshPreorder() {
             break;
         }
     }
+    refreshPreorderIndices(0, static_cast<unsigned>(_tree->_preorder.size()));
+}
+
+// Record the positions of the nodes in [begin, end) of the preorder vector
+inline void TreeManip::refreshPreorderIndices(unsigned begin, unsigned end) {
+    for (unsigned i = begin; i < end; ++i) {
+        _tree->_preorder[i]->_preorder_index = i;
+    }
 }
 
 inline void TreeManip::refreshLevelOrder() {
     if (!_tree->_root) {
         return;
     }
+    _tree->_levelorder_stale = false;
 
     std::queue<Node *> q;
 
@@ -368,9 +709,12 @@ inline void TreeManip::refreshLevelOrder() {
 
     Node *nd = _tree->_root->_left_child;
 
-    assert(nd->_right_sib == nullptr);
+    assert(!_tree->_is_rooted || nd->_right_sib == nullptr);
 
-    q.push(nd);
+    while (nd) {
+        q.push(nd);
+        nd = nd->_right_sib;
+    }
 
     while (!q.empty()) {
         nd = q.front();
@@ -390,6 +734,16 @@ inline void TreeManip::refreshLevelOrder() {
     }
 }
 
+/*
+ * Level order is only needed by some consumers, so topology edits mark it
+ * stale rather than rebuilding it. Call this before reading _levelorder.
+ */
+inline void TreeManip::ensureLevelOrder() {
+    if (_tree->_levelorder_stale) {
+        refreshLevelOrder();
+    }
+}
+
 inline void TreeManip::renumberInternals() {
     assert(!_tree->_preorder.empty());
 
@@ -418,6 +772,25 @@ inline void TreeManip::renumberInternals() {
             nd._number = curr_internal++;
         }
     }
+
+    refreshNodeIndex();
+}
+
+/*
+ * Rebuild the lookup table from node number to Node. Nodes not yet numbered
+ * (_number equal to -1) are skipped.
+ */
+inline void TreeManip::refreshNodeIndex() {
+    int max_number = -1;
+    for (auto &nd : _tree->_nodes) {
+        max_number = std::max(max_number, nd._number);
+    }
+    _tree->_node_index.assign(max_number + 1, nullptr);
+    for (auto &nd : _tree->_nodes) {
+        if (nd._number >= 0) {
+            _tree->_node_index[nd._number] = &nd;
+        }
+    }
 }
 
 inline bool TreeManip::canHaveSibling(Node *nd, bool rooted, bool allow_polytomies) {
@@ -449,25 +822,84 @@ inline bool TreeManip::canHaveSibling(Node *nd, bool rooted, bool allow_polytomi
     return nd_can_have_sibling;
 }
 
+inline Node *TreeManip::findNodeByNumber(int node_number) {
+    auto &index = _tree->_node_index;
+    if (node_number < 0 || node_number >= static_cast<int>(index.size()) || !index[node_number]) {
+        throw XStrom(fmt::format(FMT_STRING("No node found with node number {:d}"), node_number));
+    }
+    return index[node_number];
+}
+
 inline void TreeManip::rerootAtNodeNumber(int node_number) {
     // Locate the node with the given node_number
-    Node *nd = nullptr;
-    for (auto &curr : _tree->_nodes) {
-        if (curr._number == node_number) {
-            nd = &curr;
-            break;
+    Node *nd = findNodeByNumber(node_number);
+
+    if (nd != _tree->_root) {
+        if (nd->_left_child && _tree->_is_rooted) {
+            throw XStrom(fmt::format(FMT_STRING("Cannot reroot a rooted tree at an internal node (e.g. node {:d})"), nd->_number));
         }
+        rerootAtNode(nd);
     }
+}
 
-    if (!nd) {
-        throw XStrom(fmt::format(FMT_STRING("No node found with node number {:d}"), node_number));
+/*
+ * Root an unrooted tree on the edge subtending the smallest clade containing
+ * every leaf in outgroup (0-based leaf numbers). The tree is rerooted at the
+ * ingroup end of that edge, with the outgroup clade as its first child. If the
+ * outgroup is not monophyletic, the clade will also contain some ingroup leaves.
+ */
+inline void TreeManip::rerootAtOutgroup(const std::vector<unsigned> &outgroup) {
+    if (_tree->_is_rooted) {
+        throw XStrom("Outgroup rooting requires an unrooted tree");
+    }
+    if (outgroup.empty() || outgroup.size() >= _tree->_nleaves) {
+        throw XStrom("Outgroup must contain at least one leaf and must not contain every leaf");
     }
 
-    if (nd != _tree->_root) {
-        if (nd->_left_child) {
-            throw XStrom(fmt::format(FMT_STRING("Cannot currently root trees at internal nodes (e.g. node {:d}"), nd->_number));
+    std::vector<bool> in_outgroup(_tree->_nleaves, false);
+    for (auto leaf : outgroup) {
+        if (leaf >= _tree->_nleaves) {
+            throw XStrom(fmt::format(FMT_STRING("Outgroup leaf {:d} is not in the tree"), leaf + 1));
         }
-        rerootAtNode(nd);
+        in_outgroup[leaf] = true;
+    }
+
+    // Start from an ingroup leaf so that the outgroup lies above the root
+    auto ingroup_leaf = static_cast<int>(std::find(in_outgroup.begin(), in_outgroup.end(), false) - in_outgroup.begin());
+    rerootAtNodeNumber(ingroup_leaf);
+
+    // Count outgroup leaves in each subtree (postorder); the last node in preorder
+    // whose subtree holds all of them is the outgroup clade
+    std::vector<unsigned> counts(_tree->_node_index.size(), 0);
+    auto noutgroup = static_cast<unsigned>(std::count(in_outgroup.begin(), in_outgroup.end(), true));
+    Node *clade = nullptr;
+    for (auto nd : ranges::views::reverse(_tree->_preorder)) {
+        if (!nd->_left_child && in_outgroup[nd->_number]) {
+            counts[nd->_number] = 1;
+        }
+        if (!clade && counts[nd->_number] == noutgroup) {
+            clade = nd;
+        }
+        counts[nd->_parent->_number] += counts[nd->_number];
+    }
+    assert(clade);
+
+    Node *anchor = clade->_parent;
+    if (anchor == _tree->_root) {
+        // The outgroup is everything except the current root tip
+        return;
+    }
+    rerootAtNode(anchor);
+
+    if (anchor->_left_child != clade) {
+        Node *c = anchor->_left_child;
+        while (c->_right_sib != clade) {
+            c = c->_right_sib;
+        }
+        c->_right_sib = clade->_right_sib;
+        clade->_right_sib = anchor->_left_child;
+        anchor->_left_child = clade;
+        refreshPreorder();
     }
 }
 
@@ -524,8 +956,244 @@ inline void TreeManip::rerootAtNode(Node *prospective_root) {
     }
     prospective_root->setEdgeLength(0.0);
     _tree->_root = prospective_root;
+    _tree->markAllDirty();
+    refreshPreorder();
+    _tree->_levelorder_stale = true;
+}
+
+inline void TreeManip::nniAtNodeNumber(int node_number, bool use_right_child) {
+    nni(findNodeByNumber(node_number), use_right_child);
+}
+
+inline void TreeManip::pruneAndRegraftAtNodeNumbers(int subtree_number, int target_number) {
+    pruneAndRegraft(findNodeByNumber(subtree_number), findNodeByNumber(target_number));
+}
+
+inline void TreeManip::swapSubtreesAtNodeNumbers(int first_number, int second_number) {
+    swapSubtrees(findNodeByNumber(first_number), findNodeByNumber(second_number));
+}
+
+/*
+ * Return the half-open range [begin, end) of positions in _preorder occupied by
+ * the subtree rooted at nd. Subtrees are always contiguous in preorder, and the
+ * first node after the range is the right sibling of nd or of its closest
+ * ancestor that has one, so with the stored preorder indices this takes time
+ * proportional to the depth of nd rather than to the size of the tree.
+ */
+inline std::pair<unsigned, unsigned> TreeManip::findPreorderRange(Node *nd) const {
+    assert(nd->_preorder_index < _tree->_preorder.size() && _tree->_preorder[nd->_preorder_index] == nd);
+
+    Node *next = nd;
+    while (next && !next->_right_sib) {
+        next = next->_parent;
+    }
+    auto last = static_cast<unsigned>(_tree->_preorder.size());
+    if (next) {
+        last = next->_right_sib->_preorder_index;
+    }
+    return {nd->_preorder_index, last};
+}
+
+inline bool TreeManip::isAncestorOf(Node *anc, Node *nd) const {
+    for (Node *curr = nd; curr; curr = curr->_parent) {
+        if (curr == anc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Put new_child in the position old_child occupies in parent's list of children.
+ * old_child is left detached (no parent, no right sibling).
+ */
+inline void TreeManip::replaceChild(Node *parent, Node *old_child, Node *new_child) {
+    assert(old_child->_parent == parent);
+    new_child->_right_sib = old_child->_right_sib;
+    new_child->_parent = parent;
+    if (parent->_left_child == old_child) {
+        parent->_left_child = new_child;
+    } else {
+        Node *c = parent->_left_child;
+        while (c->_right_sib != old_child) {
+            c = c->_right_sib;
+        }
+        c->_right_sib = new_child;
+    }
+    old_child->_right_sib = nullptr;
+    old_child->_parent = nullptr;
+}
+
+/*
+ * Nearest-neighbour interchange across the edge subtending nd: one of nd's
+ * first two children trades places with nd's first sibling.
+ */
+inline void TreeManip::nni(Node *nd, bool use_right_child) {
+    assert(nd);
+    if (!nd->_left_child || !nd->_left_child->_right_sib) {
+        throw XStrom(fmt::format(FMT_STRING("NNI requires node {:d} to be an internal node with at least two children"), nd->_number));
+    }
+    if (!nd->_parent) {
+        throw XStrom("NNI cannot be performed on the root node");
+    }
+
+    Node *sibling = nd->_parent->_left_child;
+    if (sibling == nd) {
+        sibling = nd->_right_sib;
+    }
+    if (!sibling) {
+        throw XStrom(fmt::format(FMT_STRING("NNI requires node {:d} to have a sibling"), nd->_number));
+    }
+
+    Node *child = (use_right_child ? nd->_left_child->_right_sib : nd->_left_child);
+    swapSubtrees(child, sibling);
+}
+
+/*
+ * Subtree prune and regraft. The parent of subtree is removed from the tree
+ * (its other child takes its place, inheriting the summed edge length), then
+ * reinserted halfway along the edge subtending target. _preorder is patched by
+ * moving the affected block rather than rebuilt.
+ */
+inline void TreeManip::pruneAndRegraft(Node *subtree, Node *target) {
+    assert(subtree && target);
+    Node *p = subtree->_parent;
+    if (!p || p == _tree->_root) {
+        throw XStrom(fmt::format(FMT_STRING("Cannot prune subtree {:d} because it is attached to the root"), subtree->_number));
+    }
+    if (!target->_parent) {
+        throw XStrom("Cannot regraft onto the root node");
+    }
+    if (target == p || isAncestorOf(subtree, target)) {
+        throw XStrom(fmt::format(FMT_STRING("Cannot regraft subtree {:d} onto node {:d}"), subtree->_number, target->_number));
+    }
+
+    Node *sibling = (p->_left_child == subtree ? subtree->_right_sib : p->_left_child);
+    if (!sibling || p->_left_child->_right_sib->_right_sib) {
+        throw XStrom(fmt::format(FMT_STRING("Cannot prune subtree {:d} because its parent does not have exactly two children"), subtree->_number));
+    }
+
+    // Make p and the pruned subtree a contiguous block at the start of p's range
+    auto &preorder = _tree->_preorder;
+    auto [p_begin, p_end] = findPreorderRange(p);
+    auto [s_begin, s_end] = findPreorderRange(subtree);
+    unsigned block_size = 1 + s_end - s_begin;
+    if (s_begin != p_begin + 1) {
+        std::rotate(preorder.begin() + p_begin + 1, preorder.begin() + s_begin, preorder.begin() + p_end);
+        refreshPreorderIndices(p_begin + 1, p_end);
+    }
+
+    // Prune: sibling takes p's place
+    replaceChild(p->_parent, p, sibling);
+    sibling->setEdgeLength(sibling->_edge_length + p->_edge_length);
+
+    // Move the block so that it sits immediately before target's subtree
+    unsigned t_begin = target->_preorder_index;
+    if (t_begin > p_begin) {
+        std::rotate(preorder.begin() + p_begin, preorder.begin() + p_begin + block_size, preorder.begin() + t_begin);
+        refreshPreorderIndices(p_begin, t_begin);
+    } else {
+        std::rotate(preorder.begin() + t_begin, preorder.begin() + p_begin, preorder.begin() + p_begin + block_size);
+        refreshPreorderIndices(t_begin, p_begin + block_size);
+    }
+
+    // Regraft: p takes target's place, with subtree and target as its children
+    replaceChild(target->_parent, target, p);
+    p->_left_child = subtree;
+    subtree->_right_sib = target;
+    target->_parent = p;
+    p->setEdgeLength(0.5 * target->_edge_length);
+    target->setEdgeLength(0.5 * target->_edge_length);
+
+    // Both nodes whose children changed now have new ancestors
+    sibling->_parent->markPartialsDirty(true);
+    p->markPartialsDirty(true);
+
+    ++_tree->_topology_version;
+    _tree->_levelorder_stale = true;
+    if (_validate_traversals) {
+        validateTraversals();
+    }
+}
+
+/*
+ * Exchange two disjoint subtrees, each taking the other's place in its
+ * parent's list of children. Edge lengths travel with the subtrees.
+ */
+inline void TreeManip::swapSubtrees(Node *first, Node *second) {
+    assert(first && second);
+    if (!first->_parent || !second->_parent) {
+        throw XStrom("Cannot swap a subtree containing the root node");
+    }
+    if (isAncestorOf(first, second) || isAncestorOf(second, first)) {
+        throw XStrom(fmt::format(FMT_STRING("Cannot swap nested subtrees {:d} and {:d}"), first->_number, second->_number));
+    }
+
+    // Preorder X A Y B Z becomes X B Y A Z
+    auto &preorder = _tree->_preorder;
+    auto a = findPreorderRange(first);
+    auto b = findPreorderRange(second);
+    if (a.first > b.first) {
+        std::swap(a, b);
+    }
+    auto a_begin = preorder.begin() + a.first;
+    std::rotate(a_begin, preorder.begin() + a.second, preorder.begin() + b.second);
+    std::rotate(a_begin, a_begin + (b.first - a.second), a_begin + (b.second - a.second));
+    refreshPreorderIndices(a.first, b.second);
+
+    Node placeholder;
+    Node *first_parent = first->_parent;
+    replaceChild(first_parent, first, &placeholder);
+    replaceChild(second->_parent, second, first);
+    replaceChild(first_parent, &placeholder, second);
+    first->_parent->markPartialsDirty(true);
+    second->_parent->markPartialsDirty(true);
+
+    ++_tree->_topology_version;
+    _tree->_levelorder_stale = true;
+    if (_validate_traversals) {
+        validateTraversals();
+    }
+}
+
+/*
+ * Compare the incrementally maintained preorder and preorder indices against
+ * a full rebuild. Level order is rebuilt lazily after edits, so it is brought
+ * up to date and checked against the tree instead: it must hold every node
+ * of the preorder once, parents before children, by nondecreasing depth.
+ */
+inline void TreeManip::validateTraversals() {
+    Node::PtrVector incremental = _tree->_preorder;
+    for (unsigned i = 0; i < incremental.size(); ++i) {
+        if (incremental[i]->_preorder_index != i) {
+            throw XStrom(fmt::format(FMT_STRING("Node {:d} has preorder index {:d} but is at position {:d}"), incremental[i]->_number,
+                                     incremental[i]->_preorder_index, i));
+        }
+    }
     refreshPreorder();
-    refreshLevelOrder();
+    if (incremental != _tree->_preorder) {
+        throw XStrom("Incrementally updated preorder does not match full refresh");
+    }
+
+    ensureLevelOrder();
+    std::vector<int> depths(_tree->_nodes.size(), -1);
+    for (auto nd : _tree->_preorder) {
+        Node *parent = nd->_parent;
+        bool top = (parent == _tree->_root);
+        depths[nd - _tree->_nodes.data()] = (top ? 0 : depths[parent - _tree->_nodes.data()] + 1);
+    }
+    if (_tree->_levelorder.size() != _tree->_preorder.size()) {
+        throw XStrom("Level order does not hold every node of the preorder");
+    }
+    int previous_depth = 0;
+    for (auto nd : _tree->_levelorder) {
+        int &depth = depths[nd - _tree->_nodes.data()];
+        if (depth < previous_depth) {
+            throw XStrom("Level order is not in order of depth or repeats a node");
+        }
+        previous_depth = depth;
+        depth = -1;// a repeated node now fails the check above
+    }
 }
 
 inline void TreeManip::buildFromNewick(const std::string &newick, bool rooted, bool allow_polytomies) {
@@ -780,9 +1448,10 @@ inline void TreeManip::buildFromNewick(const std::string &newick, bool rooted, b
 
         if (_tree->_is_rooted) {
             refreshPreorder();
-            refreshLevelOrder();
+            _tree->_levelorder_stale = true;
         } else {
-            // Root at leaf number 0
+            // Root at leaf number 0 (only leaves are numbered at this point)
+            refreshNodeIndex();
             rerootAtNodeNumber(0);
         }
         renumberInternals();
@@ -814,4 +1483,40 @@ inline void TreeManip::storeSplits(std::set<Split> &splitset) {
     }
 }
 
+/*
+ * Edge lengths in an order fixed by the topology: the edges above internal
+ * nodes come first, in the order of their splits, followed by the leaf edges
+ * indexed by leaf number. storeSplits must have been called on the current
+ * tree. An unrooted tree is rooted at a leaf whose edge is the one above the
+ * root's only child, so that edge goes in the leaf's slot and the trivial
+ * split of the root child is left out of the internal edges.
+ */
+inline void TreeManip::collectEdgeLengths(std::vector<double> &edge_lengths) const {
+    const Node *root_child = _tree->_root->_left_child;
+    bool root_tip = !_tree->_is_rooted && !root_child->_right_sib && root_child->_left_child;
+
+    std::vector<const Node *> internals;
+    internals.reserve(_tree->_ninternals);
+    for (auto nd : _tree->_preorder) {
+        if (nd->_left_child && !(root_tip && nd == root_child)) {
+            internals.push_back(nd);
+        }
+    }
+    std::stable_sort(internals.begin(), internals.end(), [](const Node *a, const Node *b) { return a->_split < b->_split; });
+
+    auto ninternals = static_cast<unsigned>(internals.size());
+    edge_lengths.assign(ninternals + _tree->_nleaves, 0.0);
+    for (unsigned i = 0; i < ninternals; ++i) {
+        edge_lengths[i] = internals[i]->_edge_length;
+    }
+    for (auto nd : _tree->_preorder) {
+        if (!nd->_left_child) {
+            edge_lengths[ninternals + nd->_number] = nd->_edge_length;
+        }
+    }
+    if (root_tip) {
+        edge_lengths[ninternals + _tree->_root->_number] = root_child->_edge_length;
+    }
+}
+
 }// namespace strom
\ No newline at end of file
@@ -5,44 +5,169 @@
 #pragma once
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
 #include <fmt/core.h>
 #include <fstream>
 #include <map>
 #include <range/v3/algorithm/sort.hpp>
 #include <range/v3/view/reverse.hpp>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "ncl/nxsmultiformat.h"
 
+#include "edge_length_summary.hpp"
+#include "ess.hpp"
+#include "hash.hpp"
+#include "heavy_hitters.hpp"
+#include "output_buffer.hpp"
+#include "parallel.hpp"
+#include "patristic.hpp"
 #include "split.hpp"
+#include "tree_file_follower.hpp"
 #include "tree_manip.hpp"
 #include "xstrom.hpp"
 
 namespace strom {
 
+enum class TableFormat { CSV, JSON, BINARY };
+
+inline TableFormat parseTableFormat(const std::string &name) {
+    if (name == "csv") {
+        return TableFormat::CSV;
+    } else if (name == "json") {
+        return TableFormat::JSON;
+    } else if (name == "binary") {
+        return TableFormat::BINARY;
+    }
+    throw XStrom(fmt::format(FMT_STRING("Unknown table format {:s} (expected csv, json or binary)"), name));
+}
+
 class TreeSummary {
 public:
+    TreeSummary();
+
     void readTreefile(const std::string &filename, unsigned skip);
 
-    void showSummary() const;
+    void setTaxonNames(const std::vector<std::string> &names);
+
+    void storeTree(TreeManip &tm, const std::string &newick, Split::treeid_t &splitset);
+
+    void setParseCache(bool use_cache);
+
+    void setTopK(unsigned k);
+
+    void setEdgeLengthSummaries(bool summarise);
+
+    [[nodiscard]] bool isStreaming() const;
+
+    void showSummary(bool list_trees = true) const;
+
+    void showCredibleSets(std::vector<double> levels = {0.5, 0.95, 0.99}) const;
+
+    void writeTopologyTable(const std::string &filename, TableFormat format, bool background_flush) const;
+
+    void writeSplitTable(const std::string &filename, TableFormat format, bool background_flush) const;
+
+    void showEdgeLengthSummary() const;
+
+    void showESSSummary(unsigned max_traces, unsigned nthreads) const;
+
+    void rerootAtOutgroup(const std::vector<unsigned> &outgroup, unsigned precision, unsigned nthreads);
+
+    template<typename T>
+    PatristicMatrix<T> calcMeanPatristicDistances(unsigned nthreads) const;
 
     typename Tree::SharedPtr getTree(unsigned index);
 
     std::string getNewick(unsigned index);
 
+    [[nodiscard]] unsigned getNumTrees() const { return static_cast<unsigned>(_newicks.size()); }
+
+    [[nodiscard]] const std::vector<std::string> &getTaxonNames() const { return _taxon_names; }
+
     void clear();
 
 private:
+    Split::treemap_t::iterator storeTopology(TreeManip &tm, const std::string &newick, unsigned tree_index, Split::treeid_t &splitset);
+
+    [[nodiscard]] std::map<Split, unsigned long> calcSplitCounts() const;
+
+    void addEdgeLengths(Split::treemap_t::iterator topology, const std::vector<double> &edge_lengths);
+
+    void showHeavyHitterSummary() const;
+
+    void streamTreefile(const std::string &filename, unsigned skip);
+
     Split::treemap_t _treeIDs;
     std::vector<std::string> _newicks;
+    std::vector<std::string> _taxon_names;// by leaf number
+
+    // Optional memo table from comment-stripped newick to its topology entry
+    // (and edge lengths, if these are being summarised)
+    struct ParseCacheEntry {
+        Split::treemap_t::iterator topology;
+        std::vector<double> edge_lengths;
+    };
+    bool _use_parse_cache;
+    std::unordered_map<std::string, ParseCacheEntry, StringHash> _parse_cache;
+    unsigned long _parse_cache_hits;
+    unsigned long _parse_cache_misses;
+
+    // Optional per-topology edge length statistics, keyed by the address of the
+    // topology's split set in _treeIDs (std::map nodes never move)
+    bool _summarise_edge_lengths;
+    std::unordered_map<const Split::treeid_t *, EdgeLengthSummary> _edge_length_summaries;
+    std::vector<double> _edge_lengths;
+
+    // Streaming top-k mode: neither _newicks nor _treeIDs are filled
+    HeavyHitters _heavy_hitters;
 
 public:
     typedef std::shared_ptr<TreeSummary> SharedPtr;
 };
 
+inline TreeSummary::TreeSummary() {
+    _use_parse_cache = false;
+    _summarise_edge_lengths = false;
+    clear();
+}
+
+/*
+ * When enabled, trees whose comment-stripped newick has been seen before are
+ * added to the existing topology entry without being parsed. This pays off for
+ * topology-only samples in which the same string recurs many times.
+ */
+inline void TreeSummary::setParseCache(bool use_cache) {
+    _use_parse_cache = use_cache;
+}
+
+/*
+ * A non-zero k switches to streaming mode, which tracks only (approximately)
+ * the k most frequent topologies so that memory use is bounded. Individual
+ * trees are not stored in this mode.
+ */
+inline void TreeSummary::setTopK(unsigned k) {
+    _heavy_hitters.setCapacity(k);
+}
+
+/*
+ * When enabled, the mean and variance of every edge length and of the tree
+ * length are accumulated for each topology as trees are read.
+ */
+inline void TreeSummary::setEdgeLengthSummaries(bool summarise) {
+    _summarise_edge_lengths = summarise;
+}
+
+inline bool TreeSummary::isStreaming() const {
+    return _heavy_hitters.getCapacity() > 0;
+}
+
 inline typename Tree::SharedPtr TreeSummary::getTree(unsigned int index) {
-    if (index > _newicks.size()) {
+    if (index >= _newicks.size()) {
         throw XStrom("getTree called with index greater than number of trees");
     }
 
@@ -54,7 +179,7 @@ inline typename Tree::SharedPtr TreeSummary::getTree(unsigned int index) {
 }
 
 inline std::string TreeSummary::getNewick(unsigned int index) {
-    if (index > _newicks.size()) {
+    if (index >= _newicks.size()) {
         throw XStrom("getNewick called with index greater than number of trees");
     }
     return _newicks[index];
@@ -62,13 +187,22 @@ inline std::string TreeSummary::getNewick(unsigned int index) {
 
 inline void TreeSummary::clear() {
     _newicks.clear();
+    _taxon_names.clear();
     _treeIDs.clear();
+    _parse_cache.clear();
+    _parse_cache_hits = 0;
+    _parse_cache_misses = 0;
+    _edge_length_summaries.clear();
+    _heavy_hitters.clear();
 }
 
-inline void TreeSummary::readTreefile(const std::string &filename, unsigned int skip) {
-    TreeManip tm;
-    Split::treeid_t splitset;
-
+/*
+ * Call fn(newick, taxa_block, taxon_names) for every tree description in the
+ * file, skipping the first skip trees of each TREES block. Leaf n of a
+ * description is taxon_names[n] of its TAXA block.
+ */
+template<typename Function>
+inline void forEachNewick(const std::string &filename, unsigned skip, Function fn) {
     // See http://phylo.bio.ku.edu/ncldocs/v2.1/funcdocs/index.html for NCL documentation
     MultiFormatReader nexusReader(-1, NxsReader::WARNINGS_TO_STDERR);
     try {
@@ -79,10 +213,13 @@ inline void TreeSummary::readTreefile(const std::string &filename, unsigned int
     }
 
     unsigned numTaxaBlocks = nexusReader.GetNumTaxaBlocks();
-    for (int i = 0; i < numTaxaBlocks; ++i) {
-        clear();
+    for (unsigned i = 0; i < numTaxaBlocks; ++i) {
         NxsTaxaBlock *taxaBlock = nexusReader.GetTaxaBlock(i);
         std::string taxaBlockTitle = taxaBlock->GetTitle();
+        std::vector<std::string> taxon_names;
+        for (unsigned t = 0; t < taxaBlock->GetNTax(); ++t) {
+            taxon_names.push_back(taxaBlock->GetTaxonLabel(t));
+        }
 
         const unsigned nTreesBlocks = nexusReader.GetNumTreesBlocks(taxaBlock);
         for (unsigned j = 0; j < nTreesBlocks; ++j) {
@@ -93,28 +230,7 @@ inline void TreeSummary::readTreefile(const std::string &filename, unsigned int
                 for (unsigned t = skip; t < nTrees; ++t) {
                     const NxsFullTreeDescription &d = treesBlock->GetFullTreeDescription(t);
 
-                    // store the newick tree description
-                    const std::string &newick = d.GetNewick();
-                    _newicks.push_back(newick);
-                    auto tree_index = static_cast<unsigned>(_newicks.size()) - 1;
-
-                    // build the tree
-                    tm.buildFromNewick(newick, false, false);
-
-                    // store set of splits
-                    splitset.clear();
-                    tm.storeSplits(splitset);
-
-                    auto iter = _treeIDs.lower_bound(splitset);
-
-                    if (iter == _treeIDs.end() || iter->first != splitset) {
-                        // splitset key not found in map, so need to create an entry
-                        std::vector<unsigned> v(1, tree_index);
-                        _treeIDs.insert(iter, Split::treemap_t::value_type(splitset, v));
-                    } else {
-                        // splitset key was found in map, so need to add this tree's index to vector
-                        iter->second.push_back(tree_index);
-                    }
+                    fn(d.GetNewick(), i, taxon_names);
                 }// trees loop
             }    // skip loop
         }        //TREES block loop
@@ -122,9 +238,574 @@ inline void TreeSummary::readTreefile(const std::string &filename, unsigned int
     nexusReader.DeleteBlocksFromFactories();
 }
 
-inline void TreeSummary::showSummary() const {
+inline void TreeSummary::readTreefile(const std::string &filename, unsigned int skip) {
+    if (isStreaming()) {
+        streamTreefile(filename, skip);
+        return;
+    }
+    TreeManip tm;
+    Split::treeid_t splitset;
+
+    // only the trees of the last TAXA block are kept
+    int current_block = -1;
+    forEachNewick(filename, skip, [&](const std::string &newick, unsigned taxa_block, const std::vector<std::string> &taxon_names) {
+        if (static_cast<int>(taxa_block) != current_block) {
+            clear();
+            _taxon_names = taxon_names;
+            current_block = static_cast<int>(taxa_block);
+        }
+        storeTree(tm, newick, splitset);
+    });
+}
+
+/*
+ * In streaming mode the file is read one statement at a time, rather than by
+ * NCL, which would hold every tree description in memory at once. Only the
+ * first TREES block is read.
+ */
+inline void TreeSummary::streamTreefile(const std::string &filename, unsigned skip) {
+    if (!std::filesystem::exists(filename)) {
+        throw XStrom(fmt::format(FMT_STRING("Could not open tree file {:s}"), filename));
+    }
+    clear();
+    TreeManip tm;
+    Split::treeid_t splitset;
+    TreeFileFollower reader;
+    reader.open(filename);
+    unsigned index = 0;
+    reader.poll([&](const std::string &newick) {
+        if (index++ >= skip) {
+            storeTree(tm, newick, splitset);
+        }
+    });
+    reader.checkComplete();
+    _taxon_names = reader.getTaxonNames();
+}
+
+// Taxon names by leaf number, for trees stored without readTreefile
+inline void TreeSummary::setTaxonNames(const std::vector<std::string> &names) {
+    _taxon_names = names;
+}
+
+inline void TreeSummary::storeTree(TreeManip &tm, const std::string &newick, Split::treeid_t &splitset) {
+    if (isStreaming()) {
+        tm.buildFromNewick(newick, false, false);
+        _heavy_hitters.add(tm.calcTopologyHash(), newick);
+        return;
+    }
+
+    // store the newick tree description
+    _newicks.push_back(newick);
+    auto tree_index = static_cast<unsigned>(_newicks.size()) - 1;
+
+    if (!_use_parse_cache) {
+        auto iter = storeTopology(tm, newick, tree_index, splitset);
+        if (_summarise_edge_lengths) {
+            tm.collectEdgeLengths(_edge_lengths);
+            addEdgeLengths(iter, _edge_lengths);
+        }
+        return;
+    }
+
+    std::string key = newick;
+    tm.stripOutNexusComments(key);
+    auto cached = _parse_cache.find(key);
+    if (cached != _parse_cache.end()) {
+        // identical description seen before, so skip parsing
+        ++_parse_cache_hits;
+        ParseCacheEntry &entry = cached->second;
+        entry.topology->second.push_back(tree_index);
+        if (_summarise_edge_lengths) {
+            addEdgeLengths(entry.topology, entry.edge_lengths);
+        }
+    } else {
+        ++_parse_cache_misses;
+        ParseCacheEntry entry{storeTopology(tm, newick, tree_index, splitset), {}};
+        if (_summarise_edge_lengths) {
+            tm.collectEdgeLengths(entry.edge_lengths);
+            addEdgeLengths(entry.topology, entry.edge_lengths);
+        }
+        _parse_cache.emplace(std::move(key), std::move(entry));
+    }
+}
+
+inline Split::treemap_t::iterator TreeSummary::storeTopology(TreeManip &tm, const std::string &newick, unsigned tree_index, Split::treeid_t &splitset) {
+    // build the tree
+    tm.buildFromNewick(newick, false, false);
+
+    // store set of splits
+    splitset.clear();
+    tm.storeSplits(splitset);
+
+    auto iter = _treeIDs.lower_bound(splitset);
+
+    if (iter == _treeIDs.end() || iter->first != splitset) {
+        // splitset key not found in map, so need to create an entry
+        iter = _treeIDs.insert(iter, Split::treemap_t::value_type(splitset, IndexList(tree_index)));
+    } else {
+        // splitset key was found in map, so need to add this tree's index to its list
+        iter->second.push_back(tree_index);
+    }
+    return iter;
+}
+
+// Number of trees containing each split: every topology contributes its tree count to all of its splits
+inline std::map<Split, unsigned long> TreeSummary::calcSplitCounts() const {
+    std::map<Split, unsigned long> split_counts;
+    for (auto &key_value_pair : _treeIDs) {
+        for (auto &split : key_value_pair.first) {
+            split_counts[split] += key_value_pair.second.size();
+        }
+    }
+    return split_counts;
+}
+
+inline void TreeSummary::addEdgeLengths(Split::treemap_t::iterator topology, const std::vector<double> &edge_lengths) {
+    _edge_length_summaries[&topology->first].add(edge_lengths);
+}
+
+/*
+ * Reroot every stored tree at the outgroup (0-based leaf numbers) and replace
+ * its stored newick with the rerooted description. Trees are processed in
+ * parallel, each worker using its own TreeManip.
+ */
+inline void TreeSummary::rerootAtOutgroup(const std::vector<unsigned> &outgroup, unsigned precision, unsigned nthreads) {
+    parallelFor(static_cast<unsigned>(_newicks.size()), nthreads, [&](unsigned begin, unsigned end, unsigned) {
+        TreeManip tm;
+        for (unsigned i = begin; i < end; ++i) {
+            tm.buildFromNewick(_newicks[i], false, false);
+            tm.rerootAtOutgroup(outgroup);
+            _newicks[i] = tm.makeNewick(precision);
+        }
+    });
+}
+
+/*
+ * Average the leaf-to-leaf distance matrices of all stored trees. Each worker
+ * sums its share of the trees into its own matrix; the partial sums are
+ * combined once all workers have finished.
+ */
+template<typename T>
+inline PatristicMatrix<T> TreeSummary::calcMeanPatristicDistances(unsigned nthreads) const {
+    if (_newicks.empty()) {
+        throw XStrom("No trees available for computing patristic distances");
+    }
+
+    TreeManip tm;
+    tm.buildFromNewick(_newicks[0], false, false);
+    unsigned ntaxa = tm.getTree()->numLeaves();
+    auto ntrees = static_cast<unsigned>(_newicks.size());
+
+    std::vector<PatristicMatrix<T>> partial_sums(std::max(1u, nthreads));
+    parallelFor(ntrees, nthreads, [&](unsigned begin, unsigned end, unsigned worker) {
+        PatristicMatrix<T> &sum = partial_sums[worker];
+        sum.resize(ntaxa);
+        PatristicCalculator<T> calculator;
+        TreeManip worker_tm;
+        for (unsigned i = begin; i < end; ++i) {
+            worker_tm.buildFromNewick(_newicks[i], false, false);
+            calculator.accumulate(*worker_tm.getTree(), sum);
+        }
+    });
+
+    PatristicMatrix<T> mean(ntaxa);
+    for (auto &sum : partial_sums) {
+        if (sum.getNumTaxa() == ntaxa) {
+            mean.add(sum);
+        }
+    }
+    mean.scale(T(1) / static_cast<T>(ntrees));
+    return mean;
+}
+
+/*
+ * Report the smallest sets of topologies whose combined sample frequency
+ * reaches each of the requested levels, with a representative newick (the
+ * first tree sampled) for each topology. Only the head of the frequency
+ * distribution is ordered: blocks of the most frequent remaining topologies
+ * are selected with nth_element and sorted, doubling in size until the
+ * largest level is reached.
+ */
+inline void TreeSummary::showCredibleSets(std::vector<double> levels) const {
+    if (isStreaming()) {
+        throw XStrom("Exact credible sets are not available when tracking only the top k topologies");
+    }
+    if (_treeIDs.empty()) {
+        return;
+    }
+
+    // (count, topology number) pairs; topologies are numbered as in showSummary
+    typedef std::pair<unsigned, unsigned> count_topology_t;
+    std::vector<count_topology_t> counts;
+    std::vector<Split::treemap_t::const_iterator> entries;
+    counts.reserve(_treeIDs.size());
+    entries.reserve(_treeIDs.size());
+    for (auto iter = _treeIDs.begin(); iter != _treeIDs.end(); ++iter) {
+        counts.emplace_back(iter->second.size(), static_cast<unsigned>(entries.size()) + 1);
+        entries.push_back(iter);
+    }
+
+    auto more_frequent = [](const count_topology_t &a, const count_topology_t &b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+
+    std::sort(levels.begin(), levels.end());
+    auto ntopologies = static_cast<unsigned>(counts.size());
+    auto total = static_cast<double>(_newicks.size());
+    unsigned nsorted = 0;
+    unsigned nincluded = 0;
+    unsigned long cumulative = 0;
+    std::vector<unsigned> set_sizes;
+    for (double level : levels) {
+        auto needed = static_cast<unsigned long>(std::ceil(level * total));
+        while (cumulative < needed && nincluded < ntopologies) {
+            if (nincluded == nsorted) {
+                unsigned block_end = std::min(ntopologies, std::max(2 * nsorted, nsorted + 64));
+                std::nth_element(counts.begin() + nsorted, counts.begin() + block_end - 1, counts.end(), more_frequent);
+                std::sort(counts.begin() + nsorted, counts.begin() + block_end, more_frequent);
+                nsorted = block_end;
+            }
+            cumulative += counts[nincluded++].first;
+        }
+        set_sizes.push_back(nincluded);
+    }
+
+    fmt::print("\nCredible sets of topologies:\n");
+    for (unsigned i = 0; i < levels.size(); ++i) {
+        fmt::print(FMT_STRING("{:5.1f}% credible set: {:d} topologies\n"), 100.0 * levels[i], set_sizes[i]);
+    }
+
+    fmt::print(FMT_STRING("\n{:^8s} {:^10s} {:^12s} {:^12s} {:s}\n"), "rank", "topology", "frequency", "cumulative", "newick");
+    cumulative = 0;
+    for (unsigned rank = 0; rank < nincluded; ++rank) {
+        auto [n, topology] = counts[rank];
+        cumulative += n;
+        const std::string &newick = _newicks[entries[topology - 1]->second.front()];
+        fmt::print(FMT_STRING("{:^8d} {:^10d} {:^12.5f} {:^12.5f} {:s}\n"),
+                   rank + 1, topology, n / total, static_cast<double>(cumulative) / total, newick);
+    }
+}
+
+/*
+ * Write one row per topology, numbered as in showSummary: its tree count,
+ * sample frequency, first and last tree index, and the newick of its first
+ * tree. The binary layout (native byte order) is the magic "STRMTOPO", a
+ * uint32 version, uint64 tree and row counts, then per row uint32 topology,
+ * count, first, last and newick length followed by the newick bytes.
+ */
+inline void TreeSummary::writeTopologyTable(const std::string &filename, TableFormat format, bool background_flush) const {
+    if (isStreaming()) {
+        throw XStrom("Topology tables need every tree to be stored, so are not available with --top-k");
+    }
+
+    OutputBuffer out;
+    out.open(filename, background_flush);
+    auto ntrees = static_cast<unsigned>(_newicks.size());
+    auto total = static_cast<double>(ntrees);
+
+    if (format == TableFormat::CSV) {
+        out.write("topology,count,frequency,first,last,newick\n");
+    } else if (format == TableFormat::JSON) {
+        out.print(FMT_STRING("{{\"ntrees\":{:d},\"topologies\":["), ntrees);
+    } else {
+        out.write("STRMTOPO");
+        out.writeValue(std::uint32_t(1));
+        out.writeValue(std::uint64_t(ntrees));
+        out.writeValue(std::uint64_t(_treeIDs.size()));
+    }
+
+    unsigned topology = 0;
+    for (auto &key_value_pair : _treeIDs) {
+        const IndexList &trees = key_value_pair.second;
+        const std::string &newick = _newicks[trees.front()];
+        ++topology;
+        switch (format) {
+            case TableFormat::CSV:
+                out.print(FMT_STRING("{:d},{:d},{:.6f},{:d},{:d},"), topology, trees.size(), trees.size() / total, trees.front(), trees.back());
+                out.writeCsvField(newick);
+                out.write("\n");
+                break;
+            case TableFormat::JSON:
+                out.print(FMT_STRING("{:s}{{\"topology\":{:d},\"count\":{:d},\"frequency\":{:.6f},\"first\":{:d},\"last\":{:d},\"newick\":"),
+                          topology > 1 ? "," : "", topology, trees.size(), trees.size() / total, trees.front(), trees.back());
+                out.writeJsonString(newick);
+                out.write("}");
+                break;
+            case TableFormat::BINARY:
+                out.writeValue(std::uint32_t(topology));
+                out.writeValue(std::uint32_t(trees.size()));
+                out.writeValue(std::uint32_t(trees.front()));
+                out.writeValue(std::uint32_t(trees.back()));
+                out.writeValue(std::uint32_t(newick.size()));
+                out.write(newick);
+                break;
+        }
+    }
+
+    if (format == TableFormat::JSON) {
+        out.write("]}\n");
+    }
+    out.close();
+}
+
+/*
+ * Write the number and frequency of sampled trees containing each split.
+ * Text formats show the split as its '*'/'-' pattern; the binary layout is
+ * the magic "STRMSPLT", a uint32 version, uint64 tree count, uint32 leaf and
+ * word counts, a uint64 split count, then per split a uint64 count followed
+ * by the split's 64-bit words.
+ */
+inline void TreeSummary::writeSplitTable(const std::string &filename, TableFormat format, bool background_flush) const {
+    if (isStreaming()) {
+        throw XStrom("Split tables need every tree to be stored, so are not available with --top-k");
+    }
+
+    std::map<Split, unsigned long> split_counts = calcSplitCounts();
+
+    OutputBuffer out;
+    out.open(filename, background_flush);
+    auto ntrees = static_cast<unsigned>(_newicks.size());
+    auto total = static_cast<double>(ntrees);
+
+    if (format == TableFormat::CSV) {
+        out.write("split,count,frequency\n");
+    } else if (format == TableFormat::JSON) {
+        out.print(FMT_STRING("{{\"ntrees\":{:d},\"splits\":["), ntrees);
+    } else {
+        unsigned nleaves = split_counts.empty() ? 0 : split_counts.begin()->first.getNumLeaves();
+        unsigned nunits = split_counts.empty() ? 0 : split_counts.begin()->first.getNumUnits();
+        out.write("STRMSPLT");
+        out.writeValue(std::uint32_t(1));
+        out.writeValue(std::uint64_t(ntrees));
+        out.writeValue(std::uint32_t(nleaves));
+        out.writeValue(std::uint32_t(nunits));
+        out.writeValue(std::uint64_t(split_counts.size()));
+    }
+
+    bool first = true;
+    for (auto &[split, count] : split_counts) {
+        switch (format) {
+            case TableFormat::CSV:
+                out.print(FMT_STRING("{:s},{:d},{:.6f}\n"), split.createPatternRepresentation(), count, count / total);
+                break;
+            case TableFormat::JSON:
+                out.print(FMT_STRING("{:s}{{\"split\":\"{:s}\",\"count\":{:d},\"frequency\":{:.6f}}}"),
+                          first ? "" : ",", split.createPatternRepresentation(), count, count / total);
+                break;
+            case TableFormat::BINARY:
+                out.writeValue(std::uint64_t(count));
+                for (unsigned i = 0; i < split.getNumUnits(); ++i) {
+                    out.writeValue(std::uint64_t(split.getBits(i)));
+                }
+                break;
+        }
+        first = false;
+    }
+
+    if (format == TableFormat::JSON) {
+        out.write("]}\n");
+    }
+    out.close();
+}
+
+/*
+ * Mean and standard deviation of the tree length and of each edge length,
+ * per topology. Internal edges are labelled by their split and leaf edges by
+ * their (1-based) taxon number.
+ */
+inline void TreeSummary::showEdgeLengthSummary() const {
+    if (!_summarise_edge_lengths) {
+        throw XStrom("Edge length summaries were not enabled before reading trees");
+    }
+
+    fmt::print("\nEdge lengths by topology:\n");
+    unsigned topology = 0;
+    for (auto &key_value_pair : _treeIDs) {
+        ++topology;
+        auto found = _edge_length_summaries.find(&key_value_pair.first);
+        if (found == _edge_length_summaries.end()) {
+            continue;
+        }
+        const EdgeLengthSummary &summary = found->second;
+        fmt::print(FMT_STRING("Topology {:d} ({:d} trees): tree length {:.6f} (sd {:.6f})\n"),
+                   topology, summary.getCount(), summary.getTreeLengthMean(), std::sqrt(summary.getTreeLengthVariance()));
+
+        // The trees are rooted at leaf 0, whose edge is reported as that leaf's
+        // rather than under the trivial split of the root's child
+        std::vector<const Split *> splits;
+        for (auto &split : key_value_pair.first) {
+            if (split.countBits() + 1 < split.getNumLeaves()) {
+                splits.push_back(&split);
+            }
+        }
+        auto ninternals = static_cast<unsigned>(splits.size());
+        for (unsigned i = 0; i < summary.getNumEdges(); ++i) {
+            std::string label = (i < ninternals ? splits[i]->createPatternRepresentation() : fmt::format(FMT_STRING("taxon {:d}"), i - ninternals + 1));
+            fmt::print(FMT_STRING("  {:<24s} {:>12.6f} {:>12.6f}\n"), label, summary.getMean(i), std::sqrt(summary.getVariance(i)));
+        }
+    }
+}
+
+/*
+ * Effective sample sizes of the presence/absence traces of the max_traces
+ * most frequent topologies and of the max_traces most frequent splits that
+ * are not in every tree. Each trace is rebuilt from the stored tree indices
+ * by the worker that analyses it, so only one trace per thread is in memory.
+ */
+inline void TreeSummary::showESSSummary(unsigned max_traces, unsigned nthreads) const {
+    if (isStreaming()) {
+        throw XStrom("ESS needs every tree to be stored, so is not available with --top-k");
+    }
+    auto ntrees = static_cast<unsigned long>(_newicks.size());
+    if (ntrees < 2 || max_traces == 0) {
+        return;
+    }
+
+    // A trace is the list of topologies whose trees are marked present
+    struct Trace {
+        std::string label;
+        unsigned long count;
+        std::vector<const IndexList *> trees;
+        double ess;
+    };
+    auto by_count = [](const Trace &a, const Trace &b) { return a.count > b.count; };
+
+    std::vector<Trace> topology_traces;
+    unsigned topology = 0;
+    for (auto &key_value_pair : _treeIDs) {
+        ++topology;
+        if (key_value_pair.second.size() < ntrees) {
+            topology_traces.push_back({fmt::format(FMT_STRING("topology {:d}"), topology), key_value_pair.second.size(), {&key_value_pair.second}, 0.0});
+        }
+    }
+    std::stable_sort(topology_traces.begin(), topology_traces.end(), by_count);
+    topology_traces.resize(std::min<std::size_t>(topology_traces.size(), max_traces));
+
+    std::vector<std::pair<Split, unsigned long>> splits;
+    for (auto &[split, count] : calcSplitCounts()) {
+        if (count < ntrees) {
+            splits.emplace_back(split, count);
+        }
+    }
+    std::stable_sort(splits.begin(), splits.end(), [](auto &a, auto &b) { return a.second > b.second; });
+    splits.resize(std::min<std::size_t>(splits.size(), max_traces));
+    std::map<Split, unsigned> split_trace;
+    std::vector<Trace> split_traces;
+    for (auto &[split, count] : splits) {
+        split_trace[split] = static_cast<unsigned>(split_traces.size());
+        split_traces.push_back({split.createPatternRepresentation(), count, {}, 0.0});
+    }
+    for (auto &key_value_pair : _treeIDs) {
+        for (auto &split : key_value_pair.first) {
+            auto found = split_trace.find(split);
+            if (found != split_trace.end()) {
+                split_traces[found->second].trees.push_back(&key_value_pair.second);
+            }
+        }
+    }
+
+    std::vector<Trace *> traces;
+    for (auto &trace : topology_traces) {
+        traces.push_back(&trace);
+    }
+    for (auto &trace : split_traces) {
+        traces.push_back(&trace);
+    }
+
+    parallelFor(static_cast<unsigned>(traces.size()), nthreads, [&](unsigned begin, unsigned end, unsigned) {
+        ESSCalculator calculator;
+        std::vector<double> presence;
+        for (unsigned i = begin; i < end; ++i) {
+            presence.assign(ntrees, 0.0);
+            for (const IndexList *trees : traces[i]->trees) {
+                for (unsigned tree_index : *trees) {
+                    presence[tree_index] = 1.0;
+                }
+            }
+            traces[i]->ess = calculator.calcESS(presence);
+        }
+    });
+
+    fmt::print(FMT_STRING("\nEffective sample sizes of presence/absence traces ({:d} trees):\n"), ntrees);
+    fmt::print(FMT_STRING("{:<24s} {:^12s} {:^12s}\n"), "trace", "frequency", "ESS");
+    const Trace *min_trace = nullptr;
+    for (const Trace *trace : traces) {
+        fmt::print(FMT_STRING("{:<24s} {:^12.5f} {:^12.1f}\n"), trace->label, static_cast<double>(trace->count) / static_cast<double>(ntrees), trace->ess);
+        if (!min_trace || trace->ess < min_trace->ess) {
+            min_trace = trace;
+        }
+    }
+    if (min_trace) {
+        fmt::print(FMT_STRING("Minimum ESS {:.1f} ({:s})\n"), min_trace->ess, min_trace->label);
+    } else {
+        fmt::print("Every tree has the same topology, so no trace varies\n");
+    }
+}
+
+/*
+ * Summary of the tracked topologies in streaming mode. Each count may
+ * overestimate the true frequency by up to its error, so frequencies are shown
+ * as intervals. The 95% credible set size is bracketed using the upper
+ * (count) and lower (count - error) bounds of the tracked topologies.
+ */
+inline void TreeSummary::showHeavyHitterSummary() const {
+    unsigned long total = _heavy_hitters.getTotal();
+    fmt::print(FMT_STRING("\nRead {:d} trees from file (tracking at most {:d} topologies)\n"), total, _heavy_hitters.getCapacity());
+    if (total == 0) {
+        return;
+    }
+    fmt::print(FMT_STRING("Untracked topologies were each seen at most {:d} times\n"), _heavy_hitters.getMaxError());
+
+    auto entries = _heavy_hitters.getSortedEntries();
+    fmt::print("\nTopologies sorted by estimated sample frequency:\n");
+    fmt::print(FMT_STRING("{:^10s} {:^12s} {:^12s} {:^24s}\n"), "rank", "count", "error", "frequency");
+    unsigned long target = static_cast<unsigned long>(std::ceil(0.95 * static_cast<double>(total)));
+    unsigned long upper_sum = 0;
+    unsigned long lower_sum = 0;
+    unsigned min_size = 0;
+    unsigned max_size = 0;
+    unsigned rank = 0;
+    for (auto &entry : entries) {
+        ++rank;
+        double lower = static_cast<double>(entry.count - entry.error) / static_cast<double>(total);
+        double upper = static_cast<double>(entry.count) / static_cast<double>(total);
+        fmt::print(FMT_STRING("{:^10d} {:^12d} {:^12d} {:>11.5f} - {:<11.5f}\n"), rank, entry.count, entry.error, lower, upper);
+
+        upper_sum += entry.count;
+        lower_sum += entry.count - entry.error;
+        if (min_size == 0 && upper_sum >= target) {
+            min_size = rank;
+        }
+        if (max_size == 0 && lower_sum >= target) {
+            max_size = rank;
+        }
+    }
+
+    if (max_size > 0) {
+        fmt::print(FMT_STRING("\n95% credible set contains between {:d} and {:d} topologies\n"), min_size, max_size);
+    } else if (min_size > 0) {
+        fmt::print(FMT_STRING("\n95% credible set contains at least {:d} topologies\n"), min_size);
+    } else {
+        fmt::print(FMT_STRING("\n95% credible set contains more than {:d} topologies\n"), rank);
+    }
+}
+
+/*
+ * If list_trees is false, each topology is reported by its count, first and
+ * last occurrence and number of runs, without expanding its list of trees.
+ */
+inline void TreeSummary::showSummary(bool list_trees) const {
+    if (isStreaming()) {
+        showHeavyHitterSummary();
+        return;
+    }
+
     // Produce some output to show that it works
     fmt::print(FMT_STRING("\nRead {:d} trees from file\n"), _newicks.size());
+    if (_use_parse_cache) {
+        fmt::print(FMT_STRING("Parse cache: {:d} hits, {:d} misses, {:d} distinct descriptions\n"),
+                   _parse_cache_hits, _parse_cache_misses, _parse_cache.size());
+    }
 
     // Show all unique topologies with a list of trees that have that topology
     // Also create a map that can be used to sort topologies by their sample frequency
@@ -135,10 +816,19 @@ inline void TreeSummary::showSummary() const {
         unsigned topology = ++t;
         auto ntrees = static_cast<unsigned>(key_value_pair.second.size());
         sorted.emplace_back(ntrees, topology);
-        fmt::print(FMT_STRING("Topology {:d} seen in these {:d} trees:\n {}\n"),
-                   topology,
-                   ntrees,
-                   fmt::join(key_value_pair.second.begin(), key_value_pair.second.end(), " "));
+        if (list_trees) {
+            fmt::print(FMT_STRING("Topology {:d} seen in these {:d} trees:\n {}\n"),
+                       topology,
+                       ntrees,
+                       fmt::join(key_value_pair.second.begin(), key_value_pair.second.end(), " "));
+        } else {
+            fmt::print(FMT_STRING("Topology {:d} seen in {:d} trees (first {:d}, last {:d}, {:d} runs)\n"),
+                       topology,
+                       ntrees,
+                       key_value_pair.second.front(),
+                       key_value_pair.second.back(),
+                       key_value_pair.second.numRuns());
+        }
     }
 
     // Show sorted histogram data
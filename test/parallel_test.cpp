@@ -0,0 +1,95 @@
+//
+// Created by Kevin Gori on 18/10/2026.
+//
+
+#include "parallel.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+using namespace strom;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+// Every worker must run each job exactly once
+static bool runsOnce(WorkerPool &pool) {
+    std::vector<int> calls(pool.size(), 0);
+    pool.run([&](unsigned worker) { ++calls[worker]; });
+    for (int c : calls) {
+        if (c != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    WorkerPool pool;
+    pool.start(4);
+    for (int i = 0; i < 100; ++i) {
+        check(runsOnce(pool), "jobs on a started pool");
+    }
+
+    // A restarted pool must not rerun the last job of the previous one
+    for (unsigned nworkers : {4u, 2u, 8u, 1u, 3u}) {
+        pool.stop();
+        pool.start(nworkers);
+        // let the new workers wait for a job before one is given
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        check(pool.size() == nworkers, "size after restart");
+        check(runsOnce(pool), "jobs after restart");
+    }
+
+    bool caught = false;
+    try {
+        pool.run([](unsigned worker) {
+            if (worker == 2) {
+                throw std::runtime_error("worker 2");
+            }
+        });
+    } catch (std::runtime_error &) {
+        caught = true;
+    }
+    check(caught, "exception from a worker reaches the caller");
+    check(runsOnce(pool), "jobs after an exception");
+
+    pool.stop();
+    check(pool.size() == 1 && runsOnce(pool), "stopped pool runs jobs inline");
+
+    // Items pushed out of order are consumed in order
+    OrderedQueue<unsigned> queue(3);
+    const unsigned nitems = 1000;
+    std::vector<unsigned> consumed;
+    std::thread consumer([&] {
+        for (unsigned i = 0; i < nitems; ++i) {
+            consumed.push_back(*queue.front());
+            queue.pop();
+        }
+    });
+    parallelFor(nitems, 4, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            *queue.reserve(i) = i;
+            queue.push(i);
+        }
+    });
+    consumer.join();
+    bool ordered = consumed.size() == nitems;
+    for (unsigned i = 0; ordered && i < nitems; ++i) {
+        ordered = consumed[i] == i;
+    }
+    check(ordered, "ordered queue order");
+
+    if (failures == 0) {
+        std::printf("All parallel tests passed\n");
+    }
+    return (failures == 0 ? 0 : 1);
+}